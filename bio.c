@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,6 +17,25 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Buffers are found through a hash table on (dev, blockno)
+// with a lock per bucket, so a cache hit takes only its
+// bucket's lock.  Victims for recycling are chosen by a clock
+// sweep over all buffers: brelse sets b->used, and the sweep
+// passes over (and clears) buffers used since its last visit.
+// bcache.lock serializes recycling, which is the only thing
+// that moves a buffer between buckets; it is taken before any
+// bucket lock, and only a recycler holds two bucket locks.
+//
+// bprefetch() starts reading a block without waiting for it,
+// for readahead; the buffer stays locked until the disk
+// interrupt releases it.
+//
+// Buffers come from a slab cache.  The cache starts with NBUF
+// of them and grows by one on a miss while free memory is
+// above BUF_RESERVE pages, up to NBUF_MAX.  Below the reserve,
+// each miss also hands one idle buffer back, down to NBUF.  If
+// every buffer is in use, bget sleeps until one is released.
 
 #include "types.h"
 #include "defs.h"
@@ -26,70 +45,246 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET      251
+#define NBUF_MAX     4096  // most buffers
+#define BUF_RESERVE  1024  // free pages below which the cache shrinks
+
+static void bput(struct buf*);
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;   // chain through prev/next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+  struct buf *buf[NBUF_MAX];  // every buffer, for the clock
+  uint nbuf;
+  uint hand;          // clock hand, an index into buf
+  int nwait;          // bget calls in the miss path
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Bucket chains.  Caller must hold the bucket's lock.
+static void
+bucket_insert(struct bucket *bk, struct buf *b)
+{
+  b->prev = 0;
+  b->next = bk->head;
+  if(b->next)
+    b->next->prev = b;
+  bk->head = b;
+}
+
+static void
+bucket_remove(struct bucket *bk, struct buf *b)
+{
+  if(b->prev)
+    b->prev->next = b->next;
+  else
+    bk->head = b->next;
+  if(b->next)
+    b->next->prev = b->prev;
+}
+
+static struct buf*
+bucket_find(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head; b; b = b->next)
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  return 0;
+}
+
+// Add a new buffer to the cache, in bucket bk as block
+// blockno of dev.  Caller must hold bcache.lock and bk->lock.
+// Returns 0 if out of memory or at NBUF_MAX.
+static struct buf*
+bgrow(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if(bcache.nbuf == NBUF_MAX || (b = kmem_cache_alloc(bcache.cache)) == 0)
+    return 0;
+  initsleeplock(&b->lock, "buffer");
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  b->used = 0;
+  bcache.buf[bcache.nbuf++] = b;
+  bucket_insert(bk, b);
+  return b;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  for(i = 0; i < NBUCKET; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
+  bcache.cache = kmem_cache_create("buf", sizeof(struct buf));
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // Until first used, the first buffers sit in bucket 0 as
+  // block 0 of device 0, which is never valid, so no lookup
+  // hits them.
+  for(i = 0; i < NBUF; i++){
+    if(bgrow(&bcache.bucket[0], 0, 0) == 0)
+      panic("binit");
+    bcache.buf[i]->refcnt = 0;
   }
 }
 
+// Advance the clock to an unreferenced, clean buffer that has
+// not been used since the hand last passed it, and take it
+// out of its bucket.  The buffer is bcache.buf[bcache.hand-1].
+// Caller must hold bcache.lock and bk->lock.  Returns 0 if
+// every buffer is in use.
+static struct buf*
+bclock(struct bucket *bk)
+{
+  struct buf *b;
+  struct bucket *old;
+  uint n;
+
+  // Two full turns: the first may only clear used bits.
+  for(n = 0; n < 2*bcache.nbuf; n++){
+    if(bcache.hand >= bcache.nbuf)
+      bcache.hand = 0;
+    b = bcache.buf[bcache.hand++];
+    old = bhash(b->dev, b->blockno);
+    if(old != bk)
+      acquire(&old->lock);
+    // Even if refcnt==0, B_DIRTY indicates a buffer is in use
+    // because log.c has modified it but not yet committed it.
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0){
+      if(b->used)
+        b->used = 0;
+      else {
+        bucket_remove(old, b);
+        if(old != bk)
+          release(&old->lock);
+        return b;
+      }
+    }
+    if(old != bk)
+      release(&old->lock);
+  }
+  return 0;
+}
+
+// Recycle a buffer as block blockno of dev, in bucket bk.
+// Caller must hold bcache.lock and bk->lock.  Returns 0 if
+// every buffer is in use.
+static struct buf*
+brecycle(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bclock(bk)) == 0)
+    return 0;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  bucket_insert(bk, b);
+  return b;
+}
+
+// Give one idle buffer back to the slab allocator, if there
+// are more than NBUF.  Caller must hold bcache.lock and
+// bk->lock.
+static void
+bshrink(struct bucket *bk)
+{
+  struct buf *b;
+  uint i;
+
+  if(bcache.nbuf <= NBUF || (b = bclock(bk)) == 0)
+    return;
+  i = --bcache.hand;
+  bcache.buf[i] = bcache.buf[--bcache.nbuf];
+  kmem_cache_free(bcache.cache, b);
+}
+
+// A buffer for block blockno of dev, which is not cached, in
+// bucket bk: a new one while memory allows, else a recycled
+// one.  Caller must hold bcache.lock and bk->lock.  Returns 0
+// if every buffer is in use.
+static struct buf*
+bnew(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+  int low;
+
+  low = kfreehint() < BUF_RESERVE;
+  if(!low && (b = bgrow(bk, dev, blockno)) != 0)
+    return b;
+  if((b = brecycle(bk, dev, blockno)) != 0){
+    if(low)
+      bshrink(bk);
+    return b;
+  }
+  // Every buffer is in use: grow past the reserve if possible.
+  return bgrow(bk, dev, blockno);
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
 static struct buf*
 bget(uint dev, uint blockno)
 {
+  struct bucket *bk;
   struct buf *b;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = bucket_find(bk, dev, blockno)) != 0){
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached.  Look again once recycling is locked out, in
+  // case someone else read the block in meanwhile.  nwait is
+  // raised before looking at any refcnt so that a brelse that
+  // frees a buffer after we looked at it will wake us.
+  acquire(&bcache.lock);
+  bcache.nwait++;
+  for(;;){
+    acquire(&bk->lock);
+    if((b = bucket_find(bk, dev, blockno)) != 0){
+      b->refcnt++;
+      break;
     }
+    if((b = bnew(bk, dev, blockno)) != 0)
+      break;
+    // Every buffer is in use: wait for a brelse.
+    release(&bk->lock);
+    sleep(&bcache, &bcache.lock);
   }
-  panic("bget: no buffers");
+  bcache.nwait--;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +300,42 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading block blockno of dev into the cache, for
+// readahead, unless it is cached already.  Does not wait for
+// the disk: ideintr() releases the buffer with bdone() when
+// the read finishes.  Skipped if no buffer is free, since
+// readahead is only a hint.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
+  b = bucket_find(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return;
+
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if(bucket_find(bk, dev, blockno) == 0)
+    b = bnew(bk, dev, blockno);
+  release(&bk->lock);
+  release(&bcache.lock);
+  if(b == 0)
+    return;
+
+  // Nobody holds a new buffer's lock, unless a bread() of the
+  // same block got there first and has already read it.
+  acquiresleep(&b->lock);
+  if(b->flags & B_VALID)
+    brelse(b);
+  else
+    iderw_async(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,8 +346,20 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Start writing b's contents to disk and give b up without
+// waiting: ideintr() releases it when the write finishes.
+// Must be locked; the caller must not brelse it.
+void
+bwrite_async(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_async");
+  b->flags |= B_DIRTY;
+  iderw_async(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Mark it used, so that the clock passes it over once.
 void
 brelse(struct buf *b)
 {
@@ -124,20 +367,39 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
+
+// Called by ideintr() when the asynchronous request that
+// bprefetch() or bwrite_async() started for b finishes:
+// release b on behalf of its owner.
+void
+bdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
+// Drop a reference to b, whose lock has been released.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+  int wake;
+
+  // b cannot change buckets while it is referenced.
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  b->used = 1;
+  wake = b->refcnt == 0 && bcache.nwait > 0;
+  release(&bk->lock);
+
+  if(wake){
+    acquire(&bcache.lock);
+    wakeup(&bcache);
+    release(&bcache.lock);
   }
-  
-  release(&bcache.lock);
 }
 //PAGEBREAK!
 // Blank page.
@@ -50,6 +50,37 @@ printint(int xx, int base, int sign)
   while(--i >= 0)
     consputc(buf[i]);
 }
+// Print an unsigned 64-bit number in decimal and return the
+// number of digits.  Divides sixteen bits at a time, since the
+// kernel has no 64-bit division.
+static int
+printlong(uint64 x)
+{
+  char buf[20];
+  ushort limb[4];
+  uint r, nz;
+  int i, n;
+
+  for(i = 0; i < 4; i++)
+    limb[i] = x >> (48 - 16*i);
+
+  n = 0;
+  do{
+    r = 0;
+    nz = 0;
+    for(i = 0; i < 4; i++){
+      r = (r << 16) | limb[i];
+      limb[i] = r / 10;
+      r %= 10;
+      nz |= limb[i];
+    }
+    buf[n++] = '0' + r;
+  }while(nz);
+
+  for(i = n - 1; i >= 0; i--)
+    consputc(buf[i]);
+  return n;
+}
 //PAGEBREAK: 50
 
 void
@@ -95,6 +126,11 @@ cprintf(char *fmt, ...)
       printint(*argp++,10,0);
       printspaces(width - actual_len);
       break;
+    case 'l':  // unsigned 64-bit, decimal
+      actual_len = printlong(*(uint64*)argp);
+      argp += 2;
+      printspaces(width - actual_len);
+      break;
     case 'x':
     case 'p':
       actual_len = numlen(*argp, 16);
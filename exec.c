@@ -20,8 +20,7 @@ exec(char *path, char **argv)
   struct proc *curproc = myproc();
 
   //lines added here
-  myproc()->runtime = 0;
-  myproc()->vruntime = 0;
+  sched_exec();
   myproc()->nice_value=20;
   myproc()->weight = 1024;
 
@@ -99,10 +98,13 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
-  // Commit to the user image.
+  // Commit to the user image.  The old image's mmap areas go
+  // with it, after dirty shared pages are written back.
+  mmap_release(curproc);
   oldpgdir = curproc->pgdir;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
+  curproc->rss = sz / PGSIZE;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
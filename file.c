@@ -11,15 +11,19 @@
 #include "file.h"
 
 struct devsw devsw[NDEV];
+// File structures come from a slab cache, so the number of
+// open files is limited by memory rather than by a table size.
+// The lock protects reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct kmem_cache *cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  ftable.cache = kmem_cache_create("file", sizeof(struct file));
 }
 
 // Allocate a file structure.
@@ -28,16 +32,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmem_cache_alloc(ftable.cache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -66,9 +65,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmem_cache_free(ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -92,6 +90,41 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Sequential readahead.  A read that starts where the last one
+// ended doubles f's window, from RA_MIN up to RA_MAX blocks;
+// any other read closes it.  Blocks inside the window past the
+// read that have not been prefetched yet are started without
+// waiting, so later reads find them in the buffer cache.
+// Caller must hold f->ip->lock.
+#define RA_MIN  4
+#define RA_MAX  32
+
+static void
+readahead(struct file *f, uint off, uint n)
+{
+  uint end, start;
+
+  if(off == f->ra_next && n > 0)
+    f->ra_win = f->ra_win ? (f->ra_win*2 < RA_MAX ? f->ra_win*2 : RA_MAX) : RA_MIN;
+  else {
+    f->ra_win = 0;
+    f->ra_end = 0;
+  }
+  f->ra_next = off + n;
+  if(f->ra_win == 0)
+    return;
+
+  // Blocks [start, end) still need to be started.
+  start = (off + n + BSIZE - 1) / BSIZE;
+  end = start + f->ra_win;
+  if(start < f->ra_end)
+    start = f->ra_end;
+  if(start < end){
+    iprefetch(f->ip, start * BSIZE, end - start);
+    f->ra_end = end;
+  }
+}
+
 // Read from file f.
 int
 fileread(struct file *f, char *addr, int n)
@@ -104,8 +137,10 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
+      readahead(f, f->off, r);
       f->off += r;
+    }
     iunlock(f->ip);
     return r;
   }
@@ -170,16 +205,3 @@ int file_is_writable(struct file *f) {
     }
     return f->writable; // writable 필드의 값을 반환
 }
-
-void set_offset(struct file* f, int offset){
-  if(f ==0)
-    return;
-  f->off = offset;
-  return;
-}
-
-int get_offset(struct file* f){
-  if(f == 0)
-    return -1;
-  return f->off;
-}
\ No newline at end of file
@@ -472,9 +472,41 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
   }
+  pcache_read(ip, off - n, dst - n, n);
   return n;
 }
 
+// Start reading up to n blocks of ip from offset off on into
+// the buffer cache without waiting, for readahead.  Stops at
+// the end of the file.  Caller must hold ip->lock.
+void
+iprefetch(struct inode *ip, uint off, uint n)
+{
+  if(ip->type == T_DEV)
+    return;
+  for(; n > 0 && off < ip->size; n--, off += BSIZE)
+    bprefetch(ip->dev, bmap(ip, off/BSIZE));
+}
+
+// Read the page of ip at offset off into mem for a file
+// mapping, zeroing the part past the end of the file.  The
+// offset is explicit, so no struct file is involved.  Returns
+// the number of bytes read, or -1 if off is at or past the end
+// of the file.
+int
+readpage(struct inode *ip, char *mem, uint off)
+{
+  int r;
+
+  ilock(ip);
+  r = readi(ip, mem, off, PGSIZE);
+  iunlock(ip);
+  if(r <= 0)
+    return -1;
+  memset(mem + r, 0, PGSIZE - r);
+  return r;
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -495,6 +527,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  pcache_update(ip, off, src, n);
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -1,4 +1,8 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code.
+// Requests are sorted by an elevator and adjacent ones are
+// merged into one multi-sector transfer.  Data moves by
+// bus-master DMA on a PCI IDE controller that supports it
+// (PIIX, as QEMU emulates), else by PIO.
 
 #include "types.h"
 #include "defs.h"
@@ -23,17 +27,59 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+// Bus-master registers of the primary channel, at the I/O
+// base in the controller's BAR4.
+#define BM_CMD        0x0
+#define BM_STATUS     0x2
+#define BM_PRDT       0x4
+#define BM_START      0x01  // in BM_CMD
+#define BM_READ       0x08  // in BM_CMD: disk to memory
+#define BM_ERR        0x02  // in BM_STATUS, write 1 to clear
+#define BM_INTR       0x04  // in BM_STATUS, write 1 to clear
+
+// Most buffers in one DMA transfer.
+#define NPRD          32
+
+// Most sectors moved by one READ/WRITE MULTIPLE command, and so
+// in one interrupt.
+#define IDE_MULT      16
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
 // You must hold idelock while manipulating queue.
+//
+// The first iderun bufs of the queue are the command now in
+// progress: consecutive blocks, merged into one multi-sector
+// transfer.  The rest are kept in C-LOOK elevator order: blocks
+// above the current position in ascending order, then the
+// blocks below it, again ascending.  idetail makes appending,
+// the common case for sequential I/O, O(1).
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static struct buf *idetail;
+static int iderun;
 
 static int havedisk1;
+static int idemult;   // sectors per MULTIPLE command, 0 if unsupported
+static ushort idedma; // bus-master I/O base, 0 to use PIO
 static void idestart(struct buf*);
 
+// Physical region descriptor table: one entry per buffer of a
+// DMA transfer.  Aligned so that it cannot cross a 64K boundary.
+struct prd {
+  uint addr;
+  ushort count;  // bytes
+  ushort flags;
+};
+#define PRD_EOT  0x8000  // last entry
+
+static struct prd prdt[NPRD] __attribute__((aligned(sizeof(struct prd) * NPRD)));
+
 // Wait for IDE disk to become ready.
 static int
 idewait(int checkerr)
@@ -47,6 +93,60 @@ idewait(int checkerr)
   return 0;
 }
 
+// Ask disk dev to transfer IDE_MULT sectors per interrupt in
+// READ/WRITE MULTIPLE.  Returns -1 if it refuses.
+static int
+idesetmult(int dev)
+{
+  idewait(0);
+  outb(0x1f2, IDE_MULT);
+  outb(0x1f6, 0xe0 | (dev<<4));
+  outb(0x1f7, IDE_CMD_SETMUL);
+  return idewait(1);
+}
+
+// PCI configuration space, to find the bus-master registers.
+static uint
+pciread(int dev, int func, int off)
+{
+  outl(0xcf8, 0x80000000 | (dev<<11) | (func<<8) | off);
+  return inl(0xcfc);
+}
+
+static void
+pciwrite(int dev, int func, int off, uint v)
+{
+  outl(0xcf8, 0x80000000 | (dev<<11) | (func<<8) | off);
+  outl(0xcfc, v);
+}
+
+// Find an IDE controller on PCI bus 0 that can do bus-master
+// DMA, enable it, and return its bus-master I/O base, or 0.
+static ushort
+idefinddma(void)
+{
+  int dev, func;
+  uint class, bar;
+
+  for(dev = 0; dev < 32; dev++){
+    for(func = 0; func < 8; func++){
+      if((pciread(dev, func, 0x0) & 0xffff) == 0xffff)
+        continue;
+      // Class 1 (storage), subclass 1 (IDE), bus-master capable.
+      class = pciread(dev, func, 0x8);
+      if((class >> 16) != 0x0101 || !(class & (0x80<<8)))
+        continue;
+      bar = pciread(dev, func, 0x20);  // BAR4
+      if(!(bar & 1) || (bar & 0xfffc) == 0)
+        continue;
+      // Enable I/O space and bus mastering.
+      pciwrite(dev, func, 0x4, (pciread(dev, func, 0x4) & 0xffff) | 0x5);
+      return bar & 0xfffc;
+    }
+  }
+  return 0;
+}
+
 void
 ideinit(void)
 {
@@ -65,11 +165,33 @@ ideinit(void)
     }
   }
 
+  // Use multi-sector transfers if every disk supports them.
+  if(idesetmult(0) >= 0 && (!havedisk1 || idesetmult(1) >= 0))
+    idemult = IDE_MULT;
+
+  idedma = idefinddma();
+  if(idedma)
+    cprintf("ide: bus-master DMA at 0x%x\n", idedma);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Disk order of a and b: by device, then by block.
+// Returns <0, 0 or >0.
+static int
+idecmp(struct buf *a, struct buf *b)
+{
+  if(a->dev != b->dev)
+    return a->dev < b->dev ? -1 : 1;
+  if(a->blockno != b->blockno)
+    return a->blockno < b->blockno ? -1 : 1;
+  return 0;
+}
+
+// Start the request for b, merged with the bufs that follow it
+// in the queue for the blocks right after it, in the same
+// direction.  Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
@@ -81,19 +203,58 @@ idestart(struct buf *b)
   int sector = b->blockno * sector_per_block;
   int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
   int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  struct buf *e;
+  int i, max;
 
   if (sector_per_block > 7) panic("idestart");
 
+  if(idedma){
+    read_cmd = IDE_CMD_RDDMA;
+    write_cmd = IDE_CMD_WRDMA;
+    max = NPRD * sector_per_block;
+  } else if(idemult){
+    read_cmd = IDE_CMD_RDMUL;
+    write_cmd = IDE_CMD_WRMUL;
+    max = idemult;
+  } else
+    max = sector_per_block;
+
+  iderun = 1;
+  for(e = b; e->qnext && (iderun+1) * sector_per_block <= max; e = e->qnext){
+    if(e->qnext->dev != e->dev || e->qnext->blockno != e->blockno + 1 ||
+       (e->qnext->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+    iderun++;
+  }
+
+  if(idedma){
+    // One PRD entry per buffer; each buffer's data is
+    // physically contiguous.
+    for(i = 0, e = b; i < iderun; i++, e = e->qnext){
+      prdt[i].addr = V2P(e->data);
+      prdt[i].count = BSIZE;
+      prdt[i].flags = 0;
+    }
+    prdt[iderun-1].flags = PRD_EOT;
+    outl(idedma + BM_PRDT, V2P(prdt));
+    outb(idedma + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_READ);
+    outb(idedma + BM_STATUS, inb(idedma + BM_STATUS) | BM_ERR | BM_INTR);
+  }
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, iderun * sector_per_block);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(idedma){
+    outb(0x1f7, (b->flags & B_DIRTY) ? write_cmd : read_cmd);
+    outb(idedma + BM_CMD, inb(idedma + BM_CMD) | BM_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(i = 0, e = b; i < iderun; i++, e = e->qnext)
+      outsl(0x1f0, e->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -104,24 +265,48 @@ void
 ideintr(void)
 {
   struct buf *b;
+  int ok;
+  uchar st;
 
-  // First queued buffer is the active request.
+  // The first iderun queued buffers are the active request.
   acquire(&idelock);
 
   if((b = idequeue) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(idedma){
+    // The data is already in place: stop the engine.
+    st = inb(idedma + BM_STATUS);
+    outb(idedma + BM_CMD, 0);
+    outb(idedma + BM_STATUS, st | BM_ERR | BM_INTR);
+    ok = !(st & BM_ERR) && idewait(1) >= 0;
+    if(!ok)
+      cprintf("ide: DMA error on block %d\n", b->blockno);
+  } else
+    ok = (b->flags & B_DIRTY) || idewait(1) >= 0;
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Read data if needed: all sectors of the run arrive in one
+  // block, in queue order.
+  for(; iderun > 0; iderun--){
+    b = idequeue;
+    idequeue = b->qnext;
+    if(!(b->flags & B_DIRTY) && ok && !idedma)
+      insl(0x1f0, b->data, BSIZE/4);
+
+    // Wake process waiting for this buf, or release it for
+    // bprefetch() if nobody waits.
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    if(b->flags & B_ASYNC){
+      b->flags &= ~B_ASYNC;
+      bdone(b);
+    } else
+      wakeup(b);
+  }
+  if(idequeue == 0)
+    idetail = 0;
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -130,14 +315,28 @@ ideintr(void)
   release(&idelock);
 }
 
+// Does request a go before b, when the disk head is at the
+// block of pos?  C-LOOK: those above pos come first.
+static int
+clook_before(struct buf *a, struct buf *b, struct buf *pos)
+{
+  int aup, bup;
+
+  aup = idecmp(a, pos) > 0;
+  bup = idecmp(b, pos) > 0;
+  if(aup != bup)
+    return aup;
+  return idecmp(a, b) < 0;
+}
+
 //PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Add b to idequeue in elevator order and start the disk if it
+// is idle.  Caller must hold idelock.
+static void
+idequeue_add(struct buf *b)
 {
-  struct buf **pp;
+  struct buf **pp, *last;
+  int i;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -146,17 +345,53 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);  //DOC:acquire-lock
-
-  // Append b to idequeue.
   b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
+  if(idequeue == 0){
+    // Start disk.
+    idequeue = idetail = b;
+    idestart(b);
+    return;
+  }
+
+  // The head ends up after the last block of the active run.
+  last = idequeue;
+  for(i = 1; i < iderun; i++)
+    last = last->qnext;
+
+  if(!clook_before(b, idetail, last)){
+    idetail->qnext = b;
+    idetail = b;
+    return;
+  }
+  for(pp=&last->qnext; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+    if(clook_before(b, *pp, last))
+      break;
+  b->qnext = *pp;
   *pp = b;
+  if(b->qnext == 0)
+    idetail = b;
+}
 
-  // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+// Like iderw, but return without waiting.  When the request
+// finishes, ideintr() releases b with bdone().
+void
+iderw_async(struct buf *b)
+{
+  acquire(&idelock);
+  b->flags |= B_ASYNC;
+  idequeue_add(b);
+  release(&idelock);
+}
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  acquire(&idelock);  //DOC:acquire-lock
+
+  idequeue_add(b);
 
   // Wait for request to finish.
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
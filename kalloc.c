@@ -1,6 +1,32 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, or physically
+// contiguous blocks of 2^order pages with kalloc_pages().
+//
+// Free memory is kept by a binary buddy allocator: a free list
+// of blocks for each order up to MAXORDER, each block aligned
+// to its size.  Allocation splits a larger block if need be;
+// freeing merges a block with its buddy for as long as the
+// buddy is free too.
+//
+// Each CPU keeps a magazine of free pages that kalloc() and
+// kfree() use without touching the shared pool.  Pages move
+// between a magazine and the pool MAG_BATCH at a time, when
+// the magazine runs empty or overfills.  A magazine's lock is
+// only ever contended by freemem() and reclaim.  Lock order:
+// magazine locks in CPU order, then kmem.lock, then kzero.lock.
+//
+// Pages from kalloc() carry a reference count, so that a page
+// can be mapped by several processes (copy-on-write after
+// fork).  kalloc() returns a page with one reference,
+// kpage_get() adds one and kfree() drops one, freeing the page
+// when the last goes.  Counts are updated with atomic
+// instructions, so sharing a page takes no lock.
+//
+// Freed pages are not cleared.  Build with -DKPOISON to fill
+// them with junk instead, to catch dangling references.
+// kzalloc() hands out zeroed pages, mostly from a pool that
+// idle CPUs fill ahead of time with kzero_fill().
 
 #include "types.h"
 #include "defs.h"
@@ -13,26 +39,52 @@ void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
                    // defined by the kernel linker script in kernel.ld
 
+// Free page or block.  Magazines and the zeroed pool only
+// use next; the buddy lists are doubly linked so that a
+// buddy can be unlinked when it merges.
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
+#define MAG_SIZE   64  // most pages a CPU's magazine holds
+#define MAG_BATCH  32  // pages moved to or from the pool at once
+#define ZERO_POOL  128 // pre-zeroed pages to keep on hand
+
+#define NPHYSPAGE  (PHYSTOP / PGSIZE)
+#define PG_FREE    0x80  // pgorder[]: first page of a free block
+
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER+1];
+  int nfree[MAXORDER+1];  // free blocks of each order
   int free;     //count the number of free spaces available
 } kmem;
 
-int calculate_free(void){
-  struct run* r= kmem.freelist;
-  int count = 0;
-  while(r != 0){
-    count++;
-    r = r->next;
-  }
-  return count;
-}
+// For the first page of each free buddy block, PG_FREE | order.
+// 0 for every other page.
+static uchar pgorder[NPHYSPAGE];
+
+// References to each page handed out by kalloc().
+static ushort pgref[NPHYSPAGE];
+
+struct kmag {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} kmags[NCPU];
+
+// Free pages that are already zero, except for the link
+// in their first word.
+struct {
+  struct spinlock lock;
+  struct run *list;
+  int n;
+} kzero;
+
+static struct run *kzero_take(void);
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -41,9 +93,14 @@ int calculate_free(void){
 void
 kinit1(void *vstart, void *vend)
 {
+  struct kmag *m;
+
   initlock(&kmem.lock, "kmem");
+  for(m = kmags; m < &kmags[NCPU]; m++)
+    initlock(&m->lock, "kmag");
+  initlock(&kzero.lock, "kzero");
   kmem.use_lock = 0;
-  kmem.free = calculate_free();    //initialize the free 
+  kmem.free = 0;
   freerange(vstart, vend);
 }
 
@@ -59,10 +116,153 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    pgref[V2P(p) / PGSIZE] = 1;
     kfree(p);
+  }
+}
+
+//PAGEBREAK: 30
+// Buddy lists.  Caller must hold kmem.lock.
+
+static void
+buddy_insert(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.nfree[order]++;
+  pgorder[V2P(r) / PGSIZE] = PG_FREE | order;
+}
+
+static void
+buddy_remove(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nfree[order]--;
+  pgorder[V2P(r) / PGSIZE] = 0;
+}
+
+// Take a block of 2^order pages, splitting a larger one if
+// there is none of that order.  Returns 0 if there is none
+// large enough.
+static struct run*
+buddy_alloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  buddy_remove(r, k);
+  // Give back the upper halves until the block is small enough.
+  while(k > order){
+    k--;
+    buddy_insert((struct run*)((char*)r + (PGSIZE << k)), k);
+  }
+  kmem.free -= 1 << order;
+  return r;
+}
+
+// Return a block of 2^order pages, merging it with its buddy
+// for as long as the buddy is free and whole.
+static void
+buddy_free(char *v, int order)
+{
+  uint pfn, bpfn;
+
+  kmem.free += 1 << order;
+  pfn = V2P(v) / PGSIZE;
+  while(order < MAXORDER){
+    bpfn = pfn ^ (1 << order);
+    if(bpfn >= NPHYSPAGE || pgorder[bpfn] != (PG_FREE | order))
+      break;
+    buddy_remove((struct run*)P2V(bpfn * PGSIZE), order);
+    pfn &= ~(1 << order);
+    order++;
+  }
+  buddy_insert((struct run*)P2V(pfn * PGSIZE), order);
 }
-//PAGEBREAK: 21
+
+// Lock and return this CPU's magazine.
+static struct kmag*
+mag_lock(void)
+{
+  struct kmag *m;
+
+  // Once m->lock is held interrupts stay off, so this
+  // cannot move to another CPU before the magazine is locked.
+  pushcli();
+  m = &kmags[cpuid()];
+  acquire(&m->lock);
+  popcli();
+  return m;
+}
+
+// Move up to MAG_BATCH pages from the pool into m.
+// Caller must hold m->lock.
+static void
+mag_refill(struct kmag *m)
+{
+  struct run *r;
+
+  acquire(&kmem.lock);
+  while(m->n < MAG_BATCH && (r = buddy_alloc(0)) != 0){
+    r->next = m->list;
+    m->list = r;
+    m->n++;
+  }
+  release(&kmem.lock);
+}
+
+// Move up to n pages from m back to the pool.
+// Caller must hold m->lock.
+static void
+mag_drain(struct kmag *m, int n)
+{
+  struct run *r;
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < n && (r = m->list) != 0; i++){
+    m->list = r->next;
+    m->n--;
+    buddy_free((char*)r, 0);
+  }
+  release(&kmem.lock);
+}
+
+// The pool is empty: take a page from any CPU's magazine, so
+// that pages cached elsewhere are not lost to an allocation.
+static struct run*
+mag_steal(void)
+{
+  struct kmag *m;
+  struct run *r;
+
+  for(m = kmags; m < &kmags[NCPU]; m++){
+    acquire(&m->lock);
+    if((r = m->list) != 0){
+      m->list = r->next;
+      m->n--;
+    }
+    release(&m->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
 // Free the page of physical memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
@@ -71,21 +271,34 @@ void
 kfree(char *v)
 {
   struct run *r;
+  struct kmag *m;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
+  if(pgref[V2P(v) / PGSIZE] == 0)
+    panic("kfree: free page");
+  if(__sync_sub_and_fetch(&pgref[V2P(v) / PGSIZE], 1) != 0)
+    return;  // still mapped elsewhere
 
+#ifdef KPOISON
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  kmem.free++;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    // Still initializing, on one CPU: straight to the pool.
+    buddy_free(v, 0);
+    return;
+  }
+
+  m = mag_lock();
+  r->next = m->list;
+  m->list = r;
+  m->n++;
+  if(m->n > MAG_SIZE)
+    mag_drain(m, MAG_BATCH);
+  release(&m->lock);
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -95,31 +308,218 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kmag *m;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r){
-    kmem.freelist = r->next;
-    kmem.free--;
+  if(!kmem.use_lock){
+    if((r = buddy_alloc(0)) != 0)
+      pgref[V2P(r) / PGSIZE] = 1;
+    return (char*)r;
+  }
+
+  m = mag_lock();
+  if(m->list == 0)
+    mag_refill(m);
+  if((r = m->list) != 0){
+    m->list = r->next;
+    m->n--;
+  }
+  release(&m->lock);
+  if(r == 0)
+    r = mag_steal();
+  if(r == 0)
+    r = kzero_take();
+  if(r)
+    pgref[V2P(r) / PGSIZE] = 1;
+  return (char*)r;
+}
+
+// Give every cached free page back to the buddy lists, so
+// that they can merge into larger blocks.
+static void
+kmem_reclaim(void)
+{
+  struct kmag *m;
+  struct run *r;
+
+  for(m = kmags; m < &kmags[NCPU]; m++){
+    acquire(&m->lock);
+    mag_drain(m, m->n);
+    release(&m->lock);
   }
-  if(kmem.use_lock)
+  acquire(&kmem.lock);
+  acquire(&kzero.lock);
+  while((r = kzero.list) != 0){
+    kzero.list = r->next;
+    kzero.n--;
+    buddy_free((char*)r, 0);
+  }
+  release(&kzero.lock);
+  release(&kmem.lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size.  Returns 0 if order is out of range or no block
+// that large is free.
+char*
+kalloc_pages(int order)
+{
+  struct run *r;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  if(order == 0)
+    return kalloc();
+
+  acquire(&kmem.lock);
+  r = buddy_alloc(order);
+  release(&kmem.lock);
+  if(r == 0){
+    // Pages held in the caches may complete a block.
+    kmem_reclaim();
+    acquire(&kmem.lock);
+    r = buddy_alloc(order);
     release(&kmem.lock);
+  }
   return (char*)r;
 }
 
+// Free a block returned by kalloc_pages(order).
+void
+kfree_pages(char *v, int order)
+{
+  if(order == 0){
+    kfree(v);
+    return;
+  }
+  if(order < 0 || order > MAXORDER || V2P(v) % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > PHYSTOP)
+    panic("kfree_pages");
+
+#ifdef KPOISON
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  acquire(&kmem.lock);
+  buddy_free(v, order);
+  release(&kmem.lock);
+}
+
+// Add a reference to page v, which must have come from kalloc().
+void
+kpage_get(char *v)
+{
+  if(pgref[V2P(v) / PGSIZE] == 0)
+    panic("kpage_get");
+  __sync_add_and_fetch(&pgref[V2P(v) / PGSIZE], 1);
+}
+
+// Number of references to page v.
+int
+kpage_refs(char *v)
+{
+  return pgref[V2P(v) / PGSIZE];
+}
+
+// Take a page from the zeroed pool, or 0 if it is empty.
+static struct run*
+kzero_take(void)
+{
+  struct run *r;
+
+  acquire(&kzero.lock);
+  if((r = kzero.list) != 0){
+    kzero.list = r->next;
+    kzero.n--;
+  }
+  release(&kzero.lock);
+  if(r)
+    r->next = 0;
+  return r;
+}
+
+// Allocate one zeroed page.  Comes from the zeroed pool when
+// it can, so that the clearing is not on the caller's path.
+char*
+kzalloc(void)
+{
+  struct run *r;
+  char *v;
+
+  if(kmem.use_lock && (r = kzero_take()) != 0){
+    pgref[V2P(r) / PGSIZE] = 1;
+    return (char*)r;
+  }
+  if((v = kalloc()) != 0)
+    memset(v, 0, PGSIZE);
+  return v;
+}
+
+// Zero one free page for the pool, if it is short.  Called by
+// the scheduler when it has nothing to run.
+void
+kzero_fill(void)
+{
+  struct run *r;
+
+  // Unlocked read: the pool size is only a hint here.
+  if(kzero.n >= ZERO_POOL)
+    return;
+  if((r = (struct run*)kalloc()) == 0)
+    return;
+  memset(r, 0, PGSIZE);
+  acquire(&kzero.lock);
+  r->next = kzero.list;
+  kzero.list = r;
+  kzero.n++;
+  release(&kzero.lock);
+}
+
 //project4
+// Free pages in the pool, all magazines and the zeroed pool.
+// If nfree is not 0, also fill nfree[0..MAXORDER] with the
+// number of free blocks of each order, counting cached pages
+// as order 0.  Holding every lock at once makes the numbers
+// exact, not a racy sum.
 int
-freemem(void){
-  int count =0;
+freeblocks(int *nfree){
+  struct kmag *m;
+  int count =0, k, cached;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  
-  count = kmem.free;
-  
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  for(m = kmags; m < &kmags[NCPU]; m++)
+    acquire(&m->lock);
+  acquire(&kmem.lock);
+  acquire(&kzero.lock);
+
+  cached = kzero.n;
+  for(m = kmags; m < &kmags[NCPU]; m++)
+    cached += m->n;
+  count = kmem.free + cached;
+  if(nfree){
+    for(k = 0; k <= MAXORDER; k++)
+      nfree[k] = kmem.nfree[k];
+    nfree[0] += cached;
+  }
+
+  release(&kzero.lock);
+  release(&kmem.lock);
+  for(m = kmags; m < &kmags[NCPU]; m++)
+    release(&m->lock);
   
   return count;
+}
+
+// Rough number of free pages, for memory pressure checks.
+// Read without locks, and leaves out pages cached in the
+// magazines and the zeroed pool.
+int
+kfreehint(void)
+{
+  return kmem.free;
+}
+
+int
+freemem(void){
+  if(!kmem.use_lock)
+    return kmem.free;
+  return freeblocks(0);
 }
\ No newline at end of file
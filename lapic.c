@@ -120,6 +120,18 @@ microdelay(int us)
 {
 }
 
+// Send a fixed interrupt with the given vector to one CPU.
+void
+lapicsendipi(uchar apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 #define CMOS_PORT    0x70
 #define CMOS_RETURN  0x71
 
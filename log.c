@@ -75,10 +75,12 @@ install_trans(void)
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    bwrite_async(dbuf);  // write dst to disk
     brelse(lbuf);
-    brelse(dbuf);
   }
+  // Wait for the writes, which the disk driver sorts and merges.
+  for (tail = 0; tail < log.lh.n; tail++)
+    brelse(bread(log.dev, log.lh.block[tail]));
 }
 
 // Read the log header from disk into the in-memory log header
@@ -183,10 +185,13 @@ write_log(void)
     struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    bwrite_async(to);  // write the log
     brelse(from);
-    brelse(to);
   }
+  // Wait for the log writes, which go out as large transfers,
+  // before the header commits them.
+  for (tail = 0; tail < log.lh.n; tail++)
+    brelse(bread(log.dev, log.start+tail+1));
 }
 
 static void
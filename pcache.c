@@ -0,0 +1,241 @@
+// Page cache for shared file mappings.
+//
+// Each page of a file that some process maps MAP_SHARED is
+// kept here once, keyed by inode and file offset, and every
+// sharer maps the same physical page, so writes by one are
+// seen by the others.  The cache holds one reference on the
+// page (see kpage_get) and each mapping of it another; when
+// the last mapping goes away the page leaves the cache.
+//
+// Pages are read in with readi() on first use.  A mapper
+// writes its dirty pages back with pcache_writeback(), which
+// goes through the log like filewrite().  read() and write()
+// see the cached pages too: writei() copies what it writes
+// into them and readi() reads from them, so a mapping and the
+// file never disagree.  Pages of ip are added with ip->lock
+// held, and pcache.lock nests inside inode locks.
+//
+// A shared mapping holds a reference to its file, so the
+// inode stays in the inode cache, and its address is a valid
+// key, for as long as any of its pages are here.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NPCHASH 64
+
+struct pcpage {
+  struct inode *ip;
+  uint off;             // file offset of the page
+  char *page;
+  struct pcpage *next;  // hash chain
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage *hash[NPCHASH];
+  struct kmem_cache *cache;
+} pcache;
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  pcache.cache = kmem_cache_create("pcpage", sizeof(struct pcpage));
+}
+
+static struct pcpage**
+pcslot(struct inode *ip, uint off)
+{
+  return &pcache.hash[((uint)ip / sizeof(*ip) + off / PGSIZE) % NPCHASH];
+}
+
+// Caller must hold pcache.lock.
+static struct pcpage*
+pclookup(struct inode *ip, uint off)
+{
+  struct pcpage *pc;
+
+  for(pc = *pcslot(ip, off); pc; pc = pc->next)
+    if(pc->ip == ip && pc->off == off)
+      return pc;
+  return 0;
+}
+
+// Return the cached page of ip at page-aligned offset off,
+// reading it in if need be, with a reference held for the
+// caller's mapping.  The part past the end of the file is
+// zero.  Returns 0 if off is past the end of the file or out
+// of memory.
+char*
+pcache_get(struct inode *ip, uint off)
+{
+  struct pcpage *pc, *old;
+  char *mem;
+  int r;
+
+  acquire(&pcache.lock);
+  if((pc = pclookup(ip, off)) != 0){
+    mem = pc->page;
+    kpage_get(mem);
+    release(&pcache.lock);
+    return mem;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  if((pc = kmem_cache_alloc(pcache.cache)) == 0){
+    kfree(mem);
+    return 0;
+  }
+
+  // Read the page and cache it with ip locked.  writei() only
+  // updates pages already cached, so a write() between the two
+  // would be missing from the page.
+  ilock(ip);
+  acquire(&pcache.lock);
+  if((old = pclookup(ip, off)) != 0){
+    // Another process read it in meanwhile: use that copy.
+    kpage_get(old->page);
+    release(&pcache.lock);
+    iunlock(ip);
+    kmem_cache_free(pcache.cache, pc);
+    kfree(mem);
+    return old->page;
+  }
+  release(&pcache.lock);
+
+  r = readi(ip, mem, off, PGSIZE);
+  if(r <= 0){
+    iunlock(ip);
+    kmem_cache_free(pcache.cache, pc);
+    kfree(mem);
+    return 0;
+  }
+  memset(mem + r, 0, PGSIZE - r);
+
+  acquire(&pcache.lock);
+  pc->ip = ip;
+  pc->off = off;
+  pc->page = mem;
+  pc->next = *pcslot(ip, off);
+  *pcslot(ip, off) = pc;
+  ip->npcache++;
+  kpage_get(mem);
+  release(&pcache.lock);
+  iunlock(ip);
+  return mem;
+}
+
+// Copy n bytes at off between buf and the cached pages of ip
+// covering them; to the pages if write, else from them.
+// Parts with no cached page are left alone.  Caller must hold
+// ip->lock, under which pages of ip are added to the cache, so
+// an inode that was never mapped costs no lock here.
+static void
+pccopy(struct inode *ip, uint off, char *buf, uint n, int write)
+{
+  struct pcpage *pc;
+  uint a, m;
+  char *p;
+
+  if(ip->npcache == 0)
+    return;
+  acquire(&pcache.lock);
+  for(; n > 0; n -= m, off += m, buf += m){
+    a = PGROUNDDOWN(off);
+    m = a + PGSIZE - off;
+    if(m > n)
+      m = n;
+    if((pc = pclookup(ip, a)) == 0)
+      continue;
+    p = pc->page + (off - a);
+    if(!write)
+      memmove(buf, p, m);
+    else if(buf < pc->page || buf >= pc->page + PGSIZE)
+      memmove(p, buf, m);  // not pcache_writeback() writing the page itself
+  }
+  release(&pcache.lock);
+}
+
+// Called by writei() with ip locked: put the bytes being
+// written into the cached pages as well.
+void
+pcache_update(struct inode *ip, uint off, char *src, uint n)
+{
+  pccopy(ip, off, src, n, 1);
+}
+
+// Called by readi() with ip locked: overwrite what was read
+// from disk with the cached pages, which may hold writes
+// through a mapping not yet written back.
+void
+pcache_read(struct inode *ip, uint off, char *dst, uint n)
+{
+  pccopy(ip, off, dst, n, 0);
+}
+
+// Drop a mapping's reference to page, the cached page of ip
+// at off.  Frees the page if no mapping is left.
+void
+pcache_put(struct inode *ip, uint off, char *page)
+{
+  struct pcpage **pp, *pc;
+
+  pc = 0;
+  acquire(&pcache.lock);
+  kfree(page);
+  if(kpage_refs(page) == 1){
+    for(pp = pcslot(ip, off); (pc = *pp) != 0; pp = &pc->next){
+      if(pc->page == page){
+        *pp = pc->next;
+        ip->npcache--;
+        break;
+      }
+    }
+    if(pc == 0)
+      panic("pcache_put");
+  }
+  release(&pcache.lock);
+
+  if(pc){
+    kfree(page);
+    kmem_cache_free(pcache.cache, pc);
+  }
+}
+
+// Write page back to ip at off.  Only the part inside the
+// file is written: a mapping does not extend its file.
+// Must not be called inside a transaction.
+void
+pcache_writeback(struct inode *ip, uint off, char *page)
+{
+  // As in filewrite(), a few blocks per transaction.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+  uint i, n;
+
+  for(i = 0; i < PGSIZE; i += n){
+    begin_op();
+    ilock(ip);
+    n = 0;
+    if(off + i < ip->size){
+      n = ip->size - (off + i);
+      if(n > PGSIZE - i)
+        n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      writei(ip, page + i, off + i, n);
+    }
+    iunlock(ip);
+    end_op();
+    if(n == 0)
+      break;
+  }
+}
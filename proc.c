@@ -6,14 +6,21 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
-
-
-void calculate_timeSlice(void);
-int calculate_totalWeight(void);
-int get_min_vrun_pid(void);
-struct proc* get_proc(int pid);
-struct proc* min_proc();
-void adjust_vruntime(struct proc *p);
+#include "traps.h"
+#include "rbtree.h"
+#include "schedstat.h"
+#include "procstat.h"
+
+static uint64 div_u64(uint64 n, uint d);
+static void enqueue_task(struct proc *p, int flags);
+static struct proc *pick_next_task(int cpu);
+static int select_task_cpu(void);
+static struct rq *task_rq_lock(struct proc *p);
+static uint64 sched_clock(void);
+static void update_curr(struct proc *p);
+static void put_prev_task(int cpu);
+static void schedstat_arrive(struct proc *p, uint64 now);
+static void schedstat_depart(struct proc *p);
 
 uint weight_list[40] = {
     88761,71755,56483,46273,36291,29154,23254,18705,14949,11916,
@@ -22,10 +29,52 @@ uint weight_list[40] = {
     87,70,56,45,36,29,23,18,15,
 };
 
+// 2^32 / weight_list[i], so that dividing by a weight can be
+// done as a multiply and a shift (Linux's sched_prio_to_wmult).
+uint wmult_list[40] = {
+    48388,59856,76040,92818,118348,147320,184698,229616,287308,360437,
+    449829,563644,704093,875809,1099582,1376151,1717300,2157191,2708050,3363326,
+    4194304,5237765,6557202,8165337,10153587,12820798,15790321,19976592,24970740,31350126,
+    39045157,49367440,61356676,76695844,95443717,119304647,148102320,186737708,238609294,286331153,
+};
+
+#define NSEC_PER_TICK   10000000  // timer interrupt period
+#define SCHED_PERIOD    NSEC_PER_TICK  // shared out among runnable processes
+#define WAKEUP_GRAN     (NSEC_PER_TICK / 10)  // min vruntime lead to preempt
+#define NICE_0_SHIFT    10        // weight_list[20] == 1 << NICE_0_SHIFT
+#define WMULT_SHIFT     32        // wmult_list[i] == 2^WMULT_SHIFT / weight
+
+#define ENQUEUE_WAKEUP  1   // enqueue_task(): p was sleeping
+#define ENQUEUE_NEW     2   // enqueue_task(): p was just forked
+#define BALANCE_TICKS   10  // ticks between periodic load balancing
+#define SLEEPQ_SHIFT    6
+#define NSLEEPQ         (1 << SLEEPQ_SHIFT)  // wait-channel hash buckets
+
+// CFS runqueue.  RUNNABLE processes sit in a red-black tree
+// keyed by vruntime; the leftmost one runs next.  The running
+// process is not in the tree.  load is the sum of the weights
+// of the queued processes, kept up to date on enqueue/dequeue
+// so that a time slice costs O(1) to compute.
+struct rq
+{
+  struct spinlock lock;
+  struct rb_root tasks;
+  uint nr_running;
+  uint load;
+  struct proc *curr;  // process running on this CPU, or 0
+  int need_resched;   // curr should yield at the next trap return
+  uint64 min_vruntime;
+  uint last_balance;  // ticks at the last periodic balance
+};
+
 struct
 {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct rq rq[NCPU];
+  // SLEEPING processes, hashed by p->chan and linked
+  // through p->chan_next.
+  struct proc *sleepq[NSLEEPQ];
 } ptable;
 
 static struct proc *initproc;
@@ -35,10 +84,18 @@ extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void sleepq_insert(struct proc *p);
 
 void pinit(void)
 {
+  struct rq *rq;
+
   initlock(&ptable.lock, "ptable");
+  for (rq = ptable.rq; rq < &ptable.rq[NCPU]; rq++)
+  {
+    initlock(&rq->lock, "runqueue");
+    rb_init(&rq->tasks);
+  }
 }
 
 // Must be called with interrupts disabled
@@ -109,15 +166,14 @@ found:
   p->runtime = 0;                    // this line added
   p->weight = weight_list[p->nice_value]; // this line added
   p->vruntime = 0;
-  p->carry =0;
-  p->runtick = 0;
-  p->startTime = ticks;
- 
-  for(int i = 0; i < 30; i++) {
-    p->adjusted_vruntime[i] = -1; 
-  }
+  p->exec_start = 0;
+  p->on_rq = 0;
+  p->cpu = 0;
+  memset(&p->stat, 0, sizeof(p->stat));
+  p->rss = 0;
+  p->nmmap = 0;
+  rb_init(&p->vmas);
 
-  calculate_timeSlice();
   release(&ptable.lock);
 
   // Allocate kernel stack.
@@ -160,6 +216,7 @@ void userinit(void)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
   p->sz = PGSIZE;
+  p->rss = 1;
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
   p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
@@ -178,12 +235,14 @@ void userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  enqueue_task(p, 0);
 
   release(&ptable.lock);
 }
 
 // Grow current process's memory by n bytes.
+// Growing only moves sz: page_fault() maps zeroed pages as
+// they are first touched.  Shrinking frees pages at once.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
 {
@@ -193,11 +252,16 @@ int growproc(int n)
   sz = curproc->sz;
   if (n > 0)
   {
-    if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // The heap must stay below the mmap region.
+    if (sz + n < sz || sz + n > MMAPBASE)
       return -1;
+    sz += n;
   }
   else if (n < 0)
   {
+    if (sz + n > sz)
+      return -1;
+    curproc->rss -= residentuvm(curproc->pgdir, sz + n, sz);
     if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   }
@@ -229,7 +293,22 @@ int fork(void)
     np->state = UNUSED;
     return -1;
   }
+  //project 4
+  //부모의 mmap area와 그 페이지들을 복사
+  if (mmap_copy(curproc, np) < 0)
+  {
+    mmap_release(np);
+    freevm(np->pgdir);
+    np->pgdir = 0;
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  // The parent's writable pages just became read-only.
+  lcr3(V2P(curproc->pgdir));
   np->sz = curproc->sz;
+  np->rss = curproc->rss;
   np->parent = curproc;
   *np->tf = *curproc->tf;
 
@@ -247,64 +326,15 @@ int fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
-
   np->nice_value = curproc->nice_value;
   np->weight = curproc->weight;
   np->vruntime = curproc->vruntime;
-  np->carry = curproc->carry;
   np->runtime = 0;
-  np->runtick = 0;
-  np->startTime = ticks;
-  for (i = 0; i < 30; i++) {
-    np->adjusted_vruntime[i] = curproc->adjusted_vruntime[i];
-  }
+  np->cpu = select_task_cpu();
+  enqueue_task(np, ENQUEUE_NEW);
   
   release(&ptable.lock); 
-  calculate_timeSlice();
 
-  //project 4
-  struct mmap_area area;
-  for(int i=0;i<MAX_MMAP_AREA;i++){
-    struct mmap_area curr = mmap_areas[i];
-	  if(curr.p == curproc){ //부모 process의 mmap_area를 찾아서 p만 바꾸고 삽입
-      area.addr = curr.addr;
-      area.f = curr.f;
-      area.flags = curr.flags;
-      area.length = curr.length;
-      area.p = np;
-      area.prot = curr.prot;
-
-      mmap_areas[mmap_area_count] = area;
-      mmap_area_count++;
-
-      pte_t *pte;
-      for(uint start = area.addr; start<area.addr+area.length; start+=PGSIZE){
-        if((pte = walkpgdir(curproc->pgdir,(void*)start, 0))==0){
-          //map populate가 아니였고, access한적이 없음. 그래서 pte를 딱히 만들 필요가 없었음 
-          continue;
-        }
-        if(!(*pte & PTE_P)) //not present
-          continue;
-        uint pa = PTE_ADDR(*pte); //pte의 추출한 physical addr
-        
-        char* mem;
-        if((mem = kalloc())==0)
-          return -1;
-        
-        memmove(mem, (char*)P2V(pa), PGSIZE);
-        if(mappages(np->pgdir, (void*)start, PGSIZE, V2P(mem), PTE_FLAGS(*pte)) < 0) {
-          kfree(mem);
-        }
-      }
-	  }
-  }
-  //mmap area는 생성함
-  //하지만 문제는 mmap_area에 access하려고 할때
-  //pte를 찾아볼건데, 이가 지금 parent 프로세스의 physical memory와
-  //같이 매핑되어 있음. 따라서 우리는 child process에게
-  //새로운 physical memory할당해주고 부모의 physical memory랑 copy
-  
   return pid;
 }
 // Exit the current process.  Does not return.
@@ -334,6 +364,8 @@ void exit(void)
   end_op();
   curproc->cwd = 0;
 
+  mmap_release(curproc);
+
   acquire(&ptable.lock);
 
   // Parent might be sleeping in wait().
@@ -350,18 +382,11 @@ void exit(void)
     }
   }
   
-  uint curr_tick = ticks;
-  curproc->runtime += (curr_tick - curproc->startTime)*1000;
-  
-  uint temp = curproc->vruntime;
-  curproc->vruntime += (curr_tick - curproc->startTime) *1000 * weight_list[20] / curproc->weight;
-  if(temp > curproc->vruntime)
-    curproc->carry++;
+  update_curr(curproc);
   
   
   // Jump into the scheduler, never to return.
   curproc->state = ZOMBIE;
-  calculate_timeSlice();
 
   sched();
   panic("zombie exit");
@@ -426,35 +451,35 @@ void scheduler(void)
     // 인터럽트 활성화
     sti();
 
-    acquire(&ptable.lock);
-
-    
-
-    // 최소 vruntime을 갖는 프로세스를 탐색
-    struct proc *min_vruntime_proc = min_proc();
-
     // 최소 vruntime을 갖는 프로세스 실행
-    if (min_vruntime_proc)
+    // Only take ptable.lock once there is something to run,
+    // so idle CPUs do not contend for it.
+    if ((p = pick_next_task(c - cpus)) != 0)
     {
-      
-      p = min_vruntime_proc;
-
+      acquire(&ptable.lock);
       c->proc = p;
 
       switchuvm(p);
       
-      calculate_timeSlice();
       p->state = RUNNING;
-      p->startTime = ticks;
+      p->exec_start = sched_clock();
+      p->slice_start = p->runtime;
+      schedstat_arrive(p, p->exec_start);
 
       swtch(&(c->scheduler), p->context);
 
       switchkvm();
 
+      schedstat_depart(p);
+      put_prev_task(c - cpus);
       c->proc = 0;
+      release(&ptable.lock);
+    }
+    else
+    {
+      // Nothing to run: zero a free page for later allocations.
+      kzero_fill();
     }
-    
-    release(&ptable.lock);
   }
 }
 
@@ -488,16 +513,10 @@ void yield(void)
 {
   
   acquire(&ptable.lock); // DOC: yieldlock
-  
-  myproc()->state = RUNNABLE;
 
-  uint curr_tick= ticks;
-
-  uint temp = myproc()->vruntime;
-  myproc()->runtime += (curr_tick - myproc()->startTime)*1000;
-  myproc()->vruntime += (curr_tick - myproc()->startTime) *1000 * weight_list[20] / myproc()->weight;
-  if(temp > myproc()->vruntime)
-    myproc()->carry++;
+  update_curr(myproc());
+  myproc()->stat.nivcsw++;
+  enqueue_task(myproc(), 0);
 
   sched();
   release(&ptable.lock);
@@ -548,17 +567,13 @@ void sleep(void *chan, struct spinlock *lk)
     release(lk);
   }
 
-  int curr_tick = ticks;
-  p->runtime += (curr_tick - p->startTime)*1000;
+  update_curr(p);
+  p->stat.nvcsw++;
 
-  uint temp = p->vruntime;
-  p->vruntime += (curr_tick - p->startTime)*1000 * weight_list[20] / p->weight;
-  if(temp > p->vruntime)
-    p->carry++;
-  
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  sleepq_insert(p);
 
   sched();
 
@@ -574,28 +589,62 @@ void sleep(void *chan, struct spinlock *lk)
 }
 
 // PAGEBREAK!
+//  Sleeping processes are kept in hash buckets by channel,
+//  so a wakeup only looks at processes that might be waiting
+//  on its channel rather than at the whole process table.
+//  The ptable lock must be held for all of these.
+static struct proc**
+sleepq_bucket(void *chan)
+{
+  // Multiplicative hashing: the top bits of chan * 2^32/phi.
+  return &ptable.sleepq[((uint)chan * 2654435761U) >> (32 - SLEEPQ_SHIFT)];
+}
+
+static void
+sleepq_insert(struct proc *p)
+{
+  struct proc **pp = sleepq_bucket(p->chan);
+
+  p->chan_next = *pp;
+  *pp = p;
+}
+
+static void
+sleepq_remove(struct proc *p)
+{
+  struct proc **pp;
+
+  for (pp = sleepq_bucket(p->chan); *pp; pp = &(*pp)->chan_next)
+  {
+    if (*pp == p)
+    {
+      *pp = p->chan_next;
+      p->chan_next = 0;
+      return;
+    }
+  }
+  panic("sleepq_remove");
+}
+
 //  Wake up all processes sleeping on chan.
 //  The ptable lock must be held.
 static void
 wakeup1(void *chan)
 {
-  struct proc *p;
+  struct proc **pp, *p;
   
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if (p->state == SLEEPING && p->chan == chan){
-      p->state = RUNNABLE;
-      
-      if(min_proc() == 0){
-        p->vruntime = 0;
-      }
-      
-      if(min_proc()->vruntime < (1024000/(float)p->weight)){
-        //vruntime이 음수가 되면 0으로 세팅하라
-        p->vruntime = 0;
-      }else{
-        p->vruntime = (min_proc()->vruntime) - (1024000/p->weight);
-      }
+  pp = sleepq_bucket(chan);
+  while ((p = *pp) != 0)
+  {
+    if (p->chan != chan)
+    {
+      pp = &p->chan_next;
+      continue;
     }
+    *pp = p->chan_next;
+    p->chan_next = 0;
+    enqueue_task(p, ENQUEUE_WAKEUP);
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -621,7 +670,10 @@ int kill(int pid)
       p->killed = 1;
       // Wake process from sleep if necessary.
       if (p->state == SLEEPING)
-        p->state = RUNNABLE;
+      {
+        sleepq_remove(p);
+        enqueue_task(p, ENQUEUE_WAKEUP);
+      }
       release(&ptable.lock);
       return 0;
     }
@@ -731,9 +783,12 @@ int setnice(int pid, int value)
 
     if (p->pid == pid)
     {
+      struct rq *rq = task_rq_lock(p);
+      if (p->on_rq)
+        rq->load += weight_list[value] - p->weight;
       p->nice_value = value;
       p->weight = weight_list[value];
-      calculate_timeSlice();
+      release(&rq->lock);
       release(&ptable.lock);
       return 0;
     }
@@ -744,219 +799,575 @@ int setnice(int pid, int value)
   return -1;
 }
 
+// Caller must hold ptable.lock.
+static void
+procstat_fill(struct proc *p, struct procstat *st)
+{
+  st->pid = p->pid;
+  memmove(st->name, p->name, sizeof(st->name));
+  st->state = p->state;
+  st->nice = p->nice_value;
+  st->runtime = p->runtime;
+  st->vruntime = p->vruntime;
+  st->rss = p->rss;
+  st->nmmap = p->nmmap;
+}
+
 void ps(int pid)
 {
+  static char *states[] = {
+      [UNUSED] "UNUSED",
+      [EMBRYO] "EMBRYO",
+      [SLEEPING] "SLEEPING",
+      [RUNNABLE] "RUNNABLE",
+      [RUNNING] "RUNNING",
+      [ZOMBIE] "ZOMBIE"};
   struct proc *p;
+  struct procstat st;
+  uint weight;
 
-  acquire(&ptable.lock);
+  cprintf("%10s %10s %10s %10s %15s %15s %20s %10s %15l\n", "name", "pid", "state", "priority", "runtime/weight", "runtime", "vruntime", "tick", (uint64)ticks * NSEC_PER_TICK);
 
-  if (pid == 0){    // if pid == 0, return all the processes info
-    
-    cprintf("%10s %10s %10s %10s %15s %10s %15s %10s %15d\n", "name", "pid", "state", "priority", "runtime/weight", "runtime", "vruntime", "tick", ticks*1000);
-    
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if (p->pid != 0) //for all valid processes 
-      {
-        adjust_vruntime(p);
-        if (p->state == EMBRYO)
-        {
-          cprintf("%10s %10d %10s %10d %15u %10u ", p->name, p->pid, "EMBRYO", p->nice_value, ((p->runtime) / (p->weight)), p->runtime);
-          
-          for(int i=0;i<30;i++){
-            if(p->adjusted_vruntime[i]!= -1)
-              cprintf("%d", p->adjusted_vruntime[i]);
-          }
-
-          cprintf("\n");
-        }
-        else if (p->state == SLEEPING)
-        {
-          cprintf("%10s %10d %10s %10d %15u %10u ", p->name, p->pid, "SLEEPING", p->nice_value, ((p->runtime) / (p->weight)), p->runtime);
-          
-          for(int i=0;i<30;i++){
-            if(p->adjusted_vruntime[i]!= -1)
-              cprintf("%d", p->adjusted_vruntime[i]);
-          }
-          cprintf("\n");
-        }
-        else if (p->state == RUNNING)
-        {
-          cprintf("%10s %10d %10s %10d %15u %10u ", p->name, p->pid, "RUNNING", p->nice_value, ((p->runtime) / (p->weight)), p->runtime);
-
-          for(int i=0;i<30;i++){
-            if(p->adjusted_vruntime[i]!= -1)
-              cprintf("%d", p->adjusted_vruntime[i]);
-          }
-          cprintf("\n");
-        }
-        else if (p->state == RUNNABLE)
-        {
-          cprintf("%10s %10d %10s %10d %15u %10u ", p->name, p->pid, "RUNNABLE", p->nice_value, ((p->runtime) / (p->weight)), p->runtime);
-
-          for(int i=0;i<30;i++){
-            if(p->adjusted_vruntime[i]!= -1)
-              cprintf("%d", p->adjusted_vruntime[i]);
-          }
-          cprintf("\n");
-        }
-        else if (p->state == ZOMBIE)
-        {
-          cprintf("%10s %10d %10s %10d %15u %10u ", p->name, p->pid, "ZOMBIE", p->nice_value, ((p->runtime) / (p->weight)), p->runtime);
-
-          for(int i=29;i>=0;i--){
-            if(p->adjusted_vruntime[i]!= -1)
-              cprintf("%d", p->adjusted_vruntime[i]);
-          }
-          cprintf("\n");
-        }
-        else
-          continue;
-      }
-    }
-  }
-
-  else{
-    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  // Print from a snapshot, so that ptable.lock is not held
+  // across the console output.
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  {
+    acquire(&ptable.lock);
+    // if pid == 0, return all the processes info
+    if (p->pid == 0 || p->state == UNUSED || (pid != 0 && p->pid != pid))
     {
-      if (p->pid == pid)
-      {
-        cprintf("%10s %10s %10s %10s %15s %10s %15s %10s %15d \n", "name", "pid", "state", "priority", "runtime/weight", "runtime", "vruntime", "tick", ticks*1000);
-        adjust_vruntime(p);
-        if (p->state == EMBRYO)
-        {
-          
-          cprintf("%10s %10d %10s %10d %15u %10u ", p->name, p->pid, "EMBRYO", p->nice_value, ((p->runtime) / (p->weight)), p->runtime);
-          
-          for(int i=0;i<30;i++){
-            if(p->adjusted_vruntime[i]!= -1)
-              cprintf("%d", p->adjusted_vruntime[i]);
-          }
-
-          cprintf("\n");
-        }
-        else if (p->state == SLEEPING)
-        {
-          cprintf("%10s %10d %10s %10d %15u %10u ", p->name, p->pid, "SLEEPING", p->nice_value, ((p->runtime) / (p->weight)), p->runtime);
-          
-          for(int i=0;i<30;i++){
-            if(p->adjusted_vruntime[i]!= -1)
-              cprintf("%d", p->adjusted_vruntime[i]);
-          }
-          cprintf("\n");
-        }
-        else if (p->state == RUNNING)
-        {
-          cprintf("%10s %10d %10s %10d %15u %10u ", p->name, p->pid, "RUNNING", p->nice_value, ((p->runtime) / (p->weight)), p->runtime);
-
-          for(int i=0;i<30;i++){
-            if(p->adjusted_vruntime[i]!= -1)
-              cprintf("%d", p->adjusted_vruntime[i]);
-          }
-          cprintf("\n");
-        }
-        else if (p->state == RUNNABLE)
-        {
-          cprintf("%10s %10d %10s %10d %15u %10u ", p->name, p->pid, "RUNNABLE", p->nice_value, ((p->runtime) / (p->weight)), p->runtime);
-
-          for(int i=0;i<30;i++){
-            if(p->adjusted_vruntime[i]!= -1)
-              cprintf("%d", p->adjusted_vruntime[i]);
-          }
-          cprintf("\n");
-        }
-        else if (p->state == ZOMBIE)
-        {
-          cprintf("%10s %10d %10s %10d %15u %10u ", p->name, p->pid, "ZOMBIE", p->nice_value, ((p->runtime) / (p->weight)), p->runtime);
-
-          for(int i=29;i>=0;i--){
-            if(p->adjusted_vruntime[i]!= -1)
-              cprintf("%d", p->adjusted_vruntime[i]);
-          }
-          cprintf("\n");
-        }
-      }
+      release(&ptable.lock);
+      continue;
     }
+    procstat_fill(p, &st);
+    weight = p->weight;
+    release(&ptable.lock);
+    cprintf("%10s %10d %10s %10d %15l %15l %20l\n", st.name, st.pid, states[st.state], st.nice, div_u64(st.runtime, weight), st.runtime, st.vruntime);
   }
-  release(&ptable.lock);
 }
 
-int calculate_totalWeight()
+// Copy a summary of up to n processes into the user array buf.
+// The whole table is snapshotted into a kernel page while
+// holding ptable.lock, which is released before the copy out.
+// Returns the number of processes copied, or -1.
+int procinfo(struct procstat *buf, int n)
 {
+  struct procstat *st;
   struct proc *p;
-  int total_weight = 0;
+  int i;
 
-  // calculate total weight of runqueue
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+  if (n > PGSIZE / sizeof(*st))
+    n = PGSIZE / sizeof(*st);
+  if ((st = (struct procstat *)kalloc()) == 0)
+    return -1;
+
+  i = 0;
+  acquire(&ptable.lock);
+  for (p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++)
+    if (p->state != UNUSED)
+      procstat_fill(p, &st[i++]);
+  release(&ptable.lock);
+
+  if (copyout(myproc()->pgdir, (uint)buf, st, i * sizeof(*st)) < 0)
+    i = -1;
+  kfree((char *)st);
+  return i;
+}
+
+// Copy the scheduler statistics of up to n processes into the
+// user array buf.  ptable.lock is held only while taking each
+// snapshot, not across the copy out.  Returns the number of
+// processes copied, or -1 if buf is bad.
+int schedstat(struct schedstat *buf, int n)
+{
+  struct proc *p, *curproc = myproc();
+  struct schedstat st;
+  int i;
+
+  i = 0;
+  for (p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++)
   {
-    if (p->state == RUNNABLE)
+    acquire(&ptable.lock);
+    if (p->state == UNUSED)
     {
-      total_weight += p->weight;
+      release(&ptable.lock);
+      continue;
     }
+    st = p->stat;
+    st.pid = p->pid;
+    safestrcpy(st.name, p->name, sizeof(st.name));
+    st.state = p->state;
+    st.nice = p->nice_value;
+    st.weight = p->weight;
+    st.runtime = p->runtime;
+    st.vruntime = p->vruntime;
+    release(&ptable.lock);
+
+    if (copyout(curproc->pgdir, (uint)(buf + i), &st, sizeof(st)) < 0)
+      return -1;
+    i++;
   }
-  
-  return total_weight;
+  return i;
 }
 
-void calculate_timeSlice()
+// n / d.  The kernel is not linked with libgcc, so 64-bit
+// division has to be spelled out: divide the high word, then
+// let divl divide the remainder and low word together.
+static uint64
+div_u64(uint64 n, uint d)
 {
+  uint hi, lo, qhi, qlo, rem;
+
+  hi = n >> 32;
+  lo = (uint)n;
+  qhi = hi / d;
+  rem = hi % d;
+  asm("divl %4" : "=a" (qlo), "=d" (rem) : "a" (lo), "d" (rem), "rm" (d));
+  return ((uint64)qhi << 32) | qlo;
+}
 
-  uint total_weight = calculate_totalWeight();
+// Virtual time corresponding to delta ns of real run time for
+// p: delta * weight_list[20] / p->weight, computed with p's
+// inverse weight as a fixed-point multiply and shift.
+static uint64
+calc_delta_fair(uint64 delta, struct proc *p)
+{
+  int shift;
 
-  struct proc *p;
+  // Keep delta * wmult within 64 bits.
+  shift = WMULT_SHIFT - NICE_0_SHIFT;
+  while(delta >> 32){
+    delta >>= 1;
+    shift--;
+  }
+  return (delta * wmult_list[p->nice_value]) >> shift;
+}
 
-  if (total_weight == 0)
-  {
+// Scheduler clock in ns.  Only as fine as the timer tick.
+static uint64
+sched_clock(void)
+{
+  return (uint64)ticks * NSEC_PER_TICK;
+}
+
+// p was picked to run at now: account for its wait on the
+// runqueue, and for its wakeup latency if it was woken.
+static void
+schedstat_arrive(struct proc *p, uint64 now)
+{
+  uint64 delay;
+
+  delay = now - p->last_queued;
+  p->stat.nrun++;
+  p->stat.run_delay += delay;
+  if(p->queued_wakeup && delay > p->stat.max_wakeup_latency)
+    p->stat.max_wakeup_latency = delay;
+}
+
+// p has stopped running: add the slice it ran, already charged
+// by update_curr(), to its slice length histogram.
+static void
+schedstat_depart(struct proc *p)
+{
+  uint64 len;
+  int b;
+
+  len = (p->runtime - p->slice_start) >> SCHED_HIST_SHIFT;
+  for(b = 0; len > 1 && b < SCHED_NHIST - 1; b++)
+    len >>= 1;
+  p->stat.slice_hist[b]++;
+}
+
+// Charge p, which must be running on this CPU, for the time
+// since it was last charged.  Called from the timer tick and
+// whenever p stops running (yield, sleep, exit), so every
+// interval is charged exactly once.
+static void
+update_curr(struct proc *p)
+{
+  uint64 now, delta;
+
+  now = sched_clock();
+  delta = now - p->exec_start;
+  if((long long)delta <= 0)
     return;
-  }
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-  {
-    if (p->state == RUNNABLE)
-    {
-      p->timeSlice = 1000 *  p->weight / total_weight;
-    }
-  }
+  p->exec_start = now;
+  p->runtime += delta;
+  p->vruntime += calc_delta_fair(delta, p);
+}
+
+// exec() starts the runtime of the current process over.
+// Charge the old program first, and move slice_start with
+// runtime so that runtime - slice_start, the part of the
+// current slice already run, stays the same; the unsigned
+// subtraction may wrap slice_start, but not the difference.
+void
+sched_exec(void)
+{
+  struct proc *p;
 
+  pushcli();
+  p = myproc();
+  update_curr(p);
+  p->slice_start -= p->runtime;
+  p->runtime = 0;
+  popcli();
 }
 
-void adjust_vruntime(struct proc *p){
+//PAGEBREAK: 40
+// CFS runqueues.  Each CPU has its own, protected by its own
+// lock, so CPUs choosing what to run do not contend with each
+// other.  Lock order is ptable.lock, then rq locks in index
+// order.  A process on a runqueue has on_rq set; p->cpu names
+// its runqueue and only changes with that runqueue locked.
+
+// vruntime, runtime and min_vruntime are 64-bit nanosecond
+// counters.  Compare vruntimes through their signed difference,
+// as Linux does, so that ordering stays right even if the
+// counters ever wrap.
+static int
+vruntime_before(uint64 a, uint64 b)
+{
+  return (long long)(a - b) < 0;
+}
+
+static int
+vruntime_less(struct rb_node *a, struct rb_node *b)
+{
+  return vruntime_before(rb_entry(a, struct proc, rb)->vruntime,
+                         rb_entry(b, struct proc, rb)->vruntime);
+}
+
+// Lock and return the runqueue p belongs to, rechecking in
+// case p was migrated while we waited for the lock.
+static struct rq*
+task_rq_lock(struct proc *p)
+{
+  struct rq *rq;
+
+  for(;;){
+    rq = &ptable.rq[p->cpu];
+    acquire(&rq->lock);
+    if(rq == &ptable.rq[p->cpu])
+      return rq;
+    release(&rq->lock);
+  }
+}
 
-  uint tmp_v = p->vruntime;
-  if(tmp_v==0){
-    p->adjusted_vruntime[29] = 0;
+// min_vruntime follows the smallest vruntime among the queued
+// processes and the one running, but never moves backward.
+// Caller must hold rq->lock.
+static void
+update_min_vruntime(struct rq *rq)
+{
+  struct rb_node *first;
+  struct proc *p;
+  uint64 vruntime;
+  int found;
+
+  found = 0;
+  vruntime = 0;
+  if(rq->curr){
+    vruntime = rq->curr->vruntime;
+    found = 1;
   }
-  for(int i=29; i>=0 && tmp_v != 0 ;i--){
-    p->adjusted_vruntime[i] = tmp_v % 10;
-    tmp_v /= 10; 
+  if((first = rb_first(&rq->tasks)) != 0){
+    p = rb_entry(first, struct proc, rb);
+    if(!found || vruntime_before(p->vruntime, vruntime))
+      vruntime = p->vruntime;
+    found = 1;
   }
+  if(found && vruntime_before(rq->min_vruntime, vruntime))
+    rq->min_vruntime = vruntime;
+}
 
-  while(p->carry){
-    uint temp = 4294967295;
-    int overflow = 0;
-    for(int i=29; i>=0 && temp !=0; i--){
-      int sum = p->adjusted_vruntime[i] +(temp%10) + overflow;
-      p->adjusted_vruntime[i] = sum % 10;
-      overflow = sum / 10;
-      temp /= 10;
-    }
-    p->carry--;
+// Virtual length of the time slice p would get on rq.
+static uint64
+sched_vslice(struct rq *rq, struct proc *p)
+{
+  uint slice;
+
+  slice = div_u64((uint64)SCHED_PERIOD * p->weight, rq->load + p->weight);
+  return calc_delta_fair(slice, p);
+}
+
+// Set the vruntime of a process joining rq.
+// A woken sleeper gets credit for at most half a scheduling
+// period (Linux's sched_latency/2) below min_vruntime: enough to
+// run promptly, not enough to starve the processes that kept
+// running while it slept.  A new process starts one slice after
+// min_vruntime, so forking cannot be used to jump the queue.
+static void
+place_task(struct rq *rq, struct proc *p, int flags)
+{
+  uint64 vruntime;
+
+  if(flags & ENQUEUE_NEW)
+    p->vruntime = rq->min_vruntime + sched_vslice(rq, p);
+  else if(flags & ENQUEUE_WAKEUP){
+    vruntime = rq->min_vruntime - SCHED_PERIOD / 2;
+    if(vruntime_before(p->vruntime, vruntime))
+      p->vruntime = vruntime;
   }
 }
 
-struct proc* min_proc(){
+static void
+__enqueue_task(struct rq *rq, struct proc *p)
+{
+  if(p->on_rq)
+    panic("enqueue_task");
+  rb_insert(&rq->tasks, &p->rb, vruntime_less);
+  p->on_rq = 1;
+  rq->nr_running++;
+  rq->load += p->weight;
+}
+
+static void
+__dequeue_task(struct rq *rq, struct proc *p)
+{
+  if(!p->on_rq)
+    panic("dequeue_task");
+  rb_erase(&rq->tasks, &p->rb);
+  p->on_rq = 0;
+  rq->nr_running--;
+  rq->load -= p->weight;
+}
+
+// Move p, already off src, onto CPU dst.  vruntime is
+// relative to each runqueue's min_vruntime, so carry p's lag
+// over rather than its absolute value.
+static void
+migrate_task(struct rq *src, struct proc *p, int dst)
+{
+  long long lag;
+
+  lag = (long long)(p->vruntime - src->min_vruntime);
+  p->cpu = dst;
+  p->vruntime = ptable.rq[dst].min_vruntime + lag;
+  p->stat.nmigrations++;
+}
+
+// Ask the process running on cpu to yield.  Another CPU will not
+// look at the flag until its next trap, so interrupt it now.
+// Caller must hold ptable.rq[cpu].lock.
+static void
+resched_cpu(int cpu)
+{
+  struct rq *rq = &ptable.rq[cpu];
+
+  if(rq->need_resched)
+    return;
+  rq->need_resched = 1;
+  if(cpu != cpuid())
+    lapicsendipi(cpus[cpu].apicid, T_IRQ0 + IRQ_RESCHED);
+}
 
-  struct proc* p;
-  // 최소 vruntime을 갖는 프로세스를 탐색
-  struct proc *min_vruntime_proc = 0;
-  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if (p->state != RUNNABLE)
+// Preempt the process running on rq in favour of p, which just
+// became runnable there, if p is ahead of it by more than
+// WAKEUP_GRAN of p's virtual time.  The margin keeps a pair of
+// processes waking each other from switching on every wakeup.
+static void
+check_preempt_wakeup(struct rq *rq, struct proc *p)
+{
+  struct proc *curr;
+
+  if((curr = rq->curr) == 0)
+    return;
+  if(vruntime_before(p->vruntime + calc_delta_fair(WAKEUP_GRAN, p),
+                     curr->vruntime))
+    resched_cpu(rq - ptable.rq);
+}
+
+// Mark p RUNNABLE and insert it into its CPU's runqueue.
+// flags says whether p is waking (ENQUEUE_WAKEUP) or new
+// (ENQUEUE_NEW); see place_task().  A woken process may preempt
+// the one running on its CPU.
+// Caller must hold ptable.lock.
+static void
+enqueue_task(struct proc *p, int flags)
+{
+  struct rq *rq;
+
+  rq = task_rq_lock(p);
+  update_min_vruntime(rq);
+  place_task(rq, p, flags);
+  p->last_queued = sched_clock();
+  p->queued_wakeup = (flags & ENQUEUE_WAKEUP) != 0;
+  p->state = RUNNABLE;
+  __enqueue_task(rq, p);
+  if(flags & ENQUEUE_WAKEUP)
+    check_preempt_wakeup(rq, p);
+  release(&rq->lock);
+}
+
+// The process running on cpu has given up the CPU.
+static void
+put_prev_task(int cpu)
+{
+  struct rq *rq = &ptable.rq[cpu];
+
+  acquire(&rq->lock);
+  rq->curr = 0;
+  release(&rq->lock);
+}
+
+// Whether the process running on this CPU has been asked to
+// yield, because its time slice is over or a woken process
+// should preempt it.
+int
+need_resched(void)
+{
+  int r;
+
+  pushcli();
+  r = ptable.rq[cpuid()].need_resched;
+  popcli();
+  return r;
+}
+
+// Take the process that would wait longest on src, for
+// running on CPU dst.  Caller must hold src->lock.
+static struct proc*
+steal_task(struct rq *src, int dst)
+{
+  struct rb_node *last;
+  struct proc *p;
+
+  if((last = rb_last(&src->tasks)) == 0)
+    return 0;
+  p = rb_entry(last, struct proc, rb);
+  __dequeue_task(src, p);
+  migrate_task(src, p, dst);
+  return p;
+}
+
+// The runqueue other than cpu's own with the most queued
+// processes, or 0 if none has any.  Reads nr_running without
+// locks, so the answer is only a hint.
+static struct rq*
+find_busiest_rq(int cpu)
+{
+  struct rq *rq, *busiest;
+  int i;
+
+  busiest = 0;
+  for(i = 0; i < ncpu; i++){
+    rq = &ptable.rq[i];
+    if(i == cpu || rq->nr_running == 0)
       continue;
+    if(busiest == 0 || rq->nr_running > busiest->nr_running)
+      busiest = rq;
+  }
+  return busiest;
+}
 
-    if (!min_vruntime_proc /*아무 프로세스도 가리키지 않는경우*/|| 
-        (p->vruntime < (min_vruntime_proc->vruntime) && p->carry <= (min_vruntime_proc->carry)) ||
-        (p->vruntime == min_vruntime_proc->vruntime && p->carry == min_vruntime_proc->carry && p->nice_value > min_vruntime_proc->nice_value)
-      )
-      min_vruntime_proc = p;    
-    }
-  return min_vruntime_proc;
+// Choose the next process for cpu: the leftmost one on its own
+// runqueue, or, if that is empty, one stolen from the busiest
+// other runqueue.  The chosen process is removed from its
+// runqueue and given a time slice: its share of the scheduling
+// period, weighted against everything that was queued with it.
+// Returns 0 if nothing is runnable anywhere.
+static struct proc*
+pick_next_task(int cpu)
+{
+  struct rq *rq, *busiest;
+  struct rb_node *first;
+  struct proc *p;
+  uint load;
+
+  rq = &ptable.rq[cpu];
+  acquire(&rq->lock);
+  if((first = rb_first(&rq->tasks)) != 0){
+    p = rb_entry(first, struct proc, rb);
+    __dequeue_task(rq, p);
+    rq->curr = p;
+    rq->need_resched = 0;
+    update_min_vruntime(rq);
+    load = rq->load;
+    release(&rq->lock);
+  } else {
+    release(&rq->lock);
+    if((busiest = find_busiest_rq(cpu)) == 0)
+      return 0;
+    acquire(&busiest->lock);
+    p = steal_task(busiest, cpu);
+    release(&busiest->lock);
+    if(p == 0)
+      return 0;
+    acquire(&rq->lock);
+    rq->curr = p;
+    rq->need_resched = 0;
+    update_min_vruntime(rq);
+    load = rq->load;
+    release(&rq->lock);
+  }
+  p->timeSlice = div_u64((uint64)SCHED_PERIOD * p->weight, load + p->weight);
+  return p;
+}
+
+// Called on every timer tick on every CPU.  Charges the running
+// process for the tick and asks it to yield once its time slice
+// is used up.  Every BALANCE_TICKS, also pulls one
+// process from the busiest runqueue if it has at least two more
+// queued than this CPU's; idle CPUs also steal whenever they
+// look for work in pick_next_task().
+void
+scheduler_tick(void)
+{
+  struct rq *rq, *busiest, *first, *second;
+  struct proc *p;
+  int cpu;
+
+  pushcli();
+  cpu = cpuid();
+  rq = &ptable.rq[cpu];
+  if((p = mycpu()->proc) != 0){
+    update_curr(p);
+    acquire(&rq->lock);
+    update_min_vruntime(rq);
+    if(p->runtime - p->slice_start >= p->timeSlice)
+      rq->need_resched = 1;
+    release(&rq->lock);
+  }
+  if(ticks - rq->last_balance < BALANCE_TICKS){
+    popcli();
+    return;
+  }
+  rq->last_balance = ticks;
+
+  busiest = find_busiest_rq(cpu);
+  if(busiest == 0 || busiest->nr_running < rq->nr_running + 2){
+    popcli();
+    return;
+  }
+
+  if(busiest < rq){
+    first = busiest;
+    second = rq;
+  } else {
+    first = rq;
+    second = busiest;
+  }
+  acquire(&first->lock);
+  acquire(&second->lock);
+  if(busiest->nr_running >= rq->nr_running + 2){
+    p = steal_task(busiest, cpu);
+    __enqueue_task(rq, p);
+  }
+  release(&second->lock);
+  release(&first->lock);
+  popcli();
 }
 
+// CPU for a new process: the one with the fewest queued.
+static int
+select_task_cpu(void)
+{
+  int i, best;
+
+  best = 0;
+  for(i = 1; i < ncpu; i++)
+    if(ptable.rq[i].nr_running < ptable.rq[best].nr_running)
+      best = i;
+  return best;
+}
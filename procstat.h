@@ -0,0 +1,13 @@
+// Process summary returned to user space by the procinfo
+// system call.  Times are in nanoseconds.
+
+struct procstat {
+  int pid;
+  char name[16];
+  int state;       // enum procstate
+  int nice;
+  uint64 runtime;
+  uint64 vruntime;
+  uint rss;        // resident user pages
+  uint nmmap;      // mmap areas
+};
@@ -0,0 +1,39 @@
+// List processes.
+//
+// usage: ps [pid]
+//
+// Formats the table returned by procinfo() here in user space,
+// so the kernel does not hold the process table lock while
+// printing.  Times are in ms, rss is in KB.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "procstat.h"
+
+struct procstat procs[NPROC];
+
+int
+main(int argc, char *argv[])
+{
+  int i, n, pid;
+
+  pid = 0;
+  if(argc > 1)
+    pid = atoi(argv[1]);
+  if((n = procinfo(procs, NPROC)) < 0){
+    printf(2, "ps: procinfo failed\n");
+    exit();
+  }
+  printf(1, "pid\tname\tstate\tnice\truntime\tvruntime\trss\tmmap\n");
+  for(i = 0; i < n; i++){
+    if(pid != 0 && procs[i].pid != pid)
+      continue;
+    printf(1, "%d\t%s\t%s\t%d\t%d\t%d\t%d\t%d\n",
+           procs[i].pid, procs[i].name, states[procs[i].state], procs[i].nice,
+           ms(procs[i].runtime), ms(procs[i].vruntime),
+           procs[i].rss * 4, procs[i].nmmap);
+  }
+  exit();
+}
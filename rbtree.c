@@ -0,0 +1,322 @@
+// Red-black tree.
+//
+// The tree does not allocate: callers embed a struct rb_node
+// in their own structures and supply an ordering function
+// when inserting.  Equal keys are inserted to the right of
+// existing ones, so nodes with the same key come out of
+// rb_first()/rb_next() in insertion order.
+//
+// The smallest node is cached in root->leftmost so that
+// rb_first() is O(1); insert and erase are O(log n).
+//
+// Callers provide their own locking.
+
+#include "types.h"
+#include "defs.h"
+#include "rbtree.h"
+
+void
+rb_init(struct rb_root *root)
+{
+  root->node = 0;
+  root->leftmost = 0;
+}
+
+static void
+rotate_left(struct rb_root *root, struct rb_node *x)
+{
+  struct rb_node *y = x->right;
+
+  x->right = y->left;
+  if(y->left)
+    y->left->parent = x;
+  y->parent = x->parent;
+  if(x->parent == 0)
+    root->node = y;
+  else if(x == x->parent->left)
+    x->parent->left = y;
+  else
+    x->parent->right = y;
+  y->left = x;
+  x->parent = y;
+}
+
+static void
+rotate_right(struct rb_root *root, struct rb_node *x)
+{
+  struct rb_node *y = x->left;
+
+  x->left = y->right;
+  if(y->right)
+    y->right->parent = x;
+  y->parent = x->parent;
+  if(x->parent == 0)
+    root->node = y;
+  else if(x == x->parent->right)
+    x->parent->right = y;
+  else
+    x->parent->left = y;
+  y->right = x;
+  x->parent = y;
+}
+
+static int
+isblack(struct rb_node *n)
+{
+  return n == 0 || n->color == RB_BLACK;
+}
+
+// Restore the red-black properties after inserting red node n.
+static void
+insert_fixup(struct rb_root *root, struct rb_node *n)
+{
+  struct rb_node *p, *g, *u;
+
+  while((p = n->parent) != 0 && p->color == RB_RED){
+    // A red node is never the root, so g exists.
+    g = p->parent;
+    if(p == g->left){
+      u = g->right;
+      if(!isblack(u)){
+        p->color = RB_BLACK;
+        u->color = RB_BLACK;
+        g->color = RB_RED;
+        n = g;
+        continue;
+      }
+      if(n == p->right){
+        rotate_left(root, p);
+        n = p;
+        p = n->parent;
+      }
+      p->color = RB_BLACK;
+      g->color = RB_RED;
+      rotate_right(root, g);
+    } else {
+      u = g->left;
+      if(!isblack(u)){
+        p->color = RB_BLACK;
+        u->color = RB_BLACK;
+        g->color = RB_RED;
+        n = g;
+        continue;
+      }
+      if(n == p->left){
+        rotate_right(root, p);
+        n = p;
+        p = n->parent;
+      }
+      p->color = RB_BLACK;
+      g->color = RB_RED;
+      rotate_left(root, g);
+    }
+  }
+  root->node->color = RB_BLACK;
+}
+
+// Insert n into root.  less(a, b) returns non-zero
+// if a sorts before b.
+void
+rb_insert(struct rb_root *root, struct rb_node *n,
+          int (*less)(struct rb_node*, struct rb_node*))
+{
+  struct rb_node **link, *parent;
+  int leftmost;
+
+  link = &root->node;
+  parent = 0;
+  leftmost = 1;
+  while(*link){
+    parent = *link;
+    if(less(n, parent))
+      link = &parent->left;
+    else {
+      link = &parent->right;
+      leftmost = 0;
+    }
+  }
+
+  n->parent = parent;
+  n->left = 0;
+  n->right = 0;
+  n->color = RB_RED;
+  *link = n;
+  if(leftmost)
+    root->leftmost = n;
+
+  insert_fixup(root, n);
+}
+
+// Replace the subtree rooted at u with the one rooted at v.
+static void
+transplant(struct rb_root *root, struct rb_node *u, struct rb_node *v)
+{
+  if(u->parent == 0)
+    root->node = v;
+  else if(u == u->parent->left)
+    u->parent->left = v;
+  else
+    u->parent->right = v;
+  if(v)
+    v->parent = u->parent;
+}
+
+// Restore the red-black properties after removing a black node.
+// x (possibly 0) took the removed node's place under parent p.
+static void
+erase_fixup(struct rb_root *root, struct rb_node *x, struct rb_node *p)
+{
+  struct rb_node *w;
+
+  while(x != root->node && isblack(x)){
+    if(x == p->left){
+      w = p->right;
+      if(w->color == RB_RED){
+        w->color = RB_BLACK;
+        p->color = RB_RED;
+        rotate_left(root, p);
+        w = p->right;
+      }
+      if(isblack(w->left) && isblack(w->right)){
+        w->color = RB_RED;
+        x = p;
+        p = x->parent;
+      } else {
+        if(isblack(w->right)){
+          w->left->color = RB_BLACK;
+          w->color = RB_RED;
+          rotate_right(root, w);
+          w = p->right;
+        }
+        w->color = p->color;
+        p->color = RB_BLACK;
+        if(w->right)
+          w->right->color = RB_BLACK;
+        rotate_left(root, p);
+        x = root->node;
+        break;
+      }
+    } else {
+      w = p->left;
+      if(w->color == RB_RED){
+        w->color = RB_BLACK;
+        p->color = RB_RED;
+        rotate_right(root, p);
+        w = p->left;
+      }
+      if(isblack(w->left) && isblack(w->right)){
+        w->color = RB_RED;
+        x = p;
+        p = x->parent;
+      } else {
+        if(isblack(w->left)){
+          w->right->color = RB_BLACK;
+          w->color = RB_RED;
+          rotate_left(root, w);
+          w = p->left;
+        }
+        w->color = p->color;
+        p->color = RB_BLACK;
+        if(w->left)
+          w->left->color = RB_BLACK;
+        rotate_right(root, p);
+        x = root->node;
+        break;
+      }
+    }
+  }
+  if(x)
+    x->color = RB_BLACK;
+}
+
+// Remove n from root.
+void
+rb_erase(struct rb_root *root, struct rb_node *n)
+{
+  struct rb_node *x, *p, *y;
+  int color;
+
+  if(root->leftmost == n)
+    root->leftmost = rb_next(n);
+
+  if(n->left == 0 || n->right == 0){
+    x = n->left ? n->left : n->right;
+    p = n->parent;
+    color = n->color;
+    transplant(root, n, x);
+  } else {
+    // Splice out n's successor y and put it in n's place.
+    for(y = n->right; y->left; y = y->left)
+      ;
+    color = y->color;
+    x = y->right;
+    if(y->parent == n)
+      p = y;
+    else {
+      p = y->parent;
+      transplant(root, y, x);
+      y->right = n->right;
+      y->right->parent = y;
+    }
+    transplant(root, n, y);
+    y->left = n->left;
+    y->left->parent = y;
+    y->color = n->color;
+  }
+
+  if(color == RB_BLACK)
+    erase_fixup(root, x, p);
+  n->parent = n->left = n->right = 0;
+}
+
+// Smallest node in root, or 0 if the tree is empty.
+struct rb_node*
+rb_first(struct rb_root *root)
+{
+  return root->leftmost;
+}
+
+// Largest node in root, or 0 if the tree is empty.
+struct rb_node*
+rb_last(struct rb_root *root)
+{
+  struct rb_node *n;
+
+  if((n = root->node) == 0)
+    return 0;
+  while(n->right)
+    n = n->right;
+  return n;
+}
+
+// In-order successor of n, or 0 if n is the last node.
+struct rb_node*
+rb_next(struct rb_node *n)
+{
+  struct rb_node *p;
+
+  if(n->right){
+    for(n = n->right; n->left; n = n->left)
+      ;
+    return n;
+  }
+  while((p = n->parent) != 0 && n == p->right)
+    n = p;
+  return p;
+}
+
+// In-order predecessor of n, or 0 if n is the first node.
+struct rb_node*
+rb_prev(struct rb_node *n)
+{
+  struct rb_node *p;
+
+  if(n->left){
+    for(n = n->left; n->right; n = n->right)
+      ;
+    return n;
+  }
+  while((p = n->parent) != 0 && n == p->left)
+    n = p;
+  return p;
+}
@@ -0,0 +1,27 @@
+// Intrusive red-black tree.
+// Embed a struct rb_node in the object to be kept in a tree
+// and recover the object from the node with rb_entry().
+// proc.h includes this header, hence the guard.
+
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#define RB_RED    0
+#define RB_BLACK  1
+
+struct rb_node {
+  struct rb_node *parent;
+  struct rb_node *left;
+  struct rb_node *right;
+  int color;
+};
+
+struct rb_root {
+  struct rb_node *node;      // root of the tree, or 0 if empty
+  struct rb_node *leftmost;  // cached smallest node, or 0 if empty
+};
+
+#define rb_entry(ptr, type, member) \
+  ((type*)((char*)(ptr) - (uint)&((type*)0)->member))
+
+#endif // RBTREE_H
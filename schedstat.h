@@ -0,0 +1,30 @@
+// Per-process scheduler statistics, kept in struct proc and
+// returned to user space by the schedstat system call.
+// Times are in nanoseconds of the scheduler clock.
+// proc.h includes this header, hence the guard.
+
+#ifndef SCHEDSTAT_H
+#define SCHEDSTAT_H
+
+#define SCHED_NHIST       16  // slice length histogram buckets
+#define SCHED_HIST_SHIFT  20  // bucket 0: slices under 2^(SHIFT+1) ns
+
+struct schedstat {
+  int pid;
+  char name[16];
+  int state;                    // enum procstate
+  int nice;
+  uint weight;
+  uint64 runtime;
+  uint64 vruntime;
+  uint nvcsw;                   // voluntary switches: went to sleep
+  uint nivcsw;                  // involuntary switches: preempted
+  uint nmigrations;             // moves between CPU runqueues
+  uint nrun;                    // times picked to run
+  uint64 run_delay;             // total time waiting on a runqueue
+  uint64 max_wakeup_latency;    // longest wait from wakeup to running
+  uint slice_hist[SCHED_NHIST]; // slices with length in
+                                // [2^(SHIFT+i), 2^(SHIFT+i+1)) ns
+};
+
+#endif // SCHEDSTAT_H
@@ -0,0 +1,114 @@
+// Show how the scheduler is treating each process.
+//
+// usage: schedtop [ticks [count]]
+//
+// Every ticks clock ticks (default 100), count times (default
+// forever), print for each process over the last interval: its
+// share of the CPU time used, next to the share its weight
+// entitles it to among the processes that ran; its voluntary
+// and involuntary switches and migrations; the time it spent
+// waiting on a runqueue.  Also its worst wakeup latency and a
+// histogram of its slice lengths since it started.  Times are
+// in ms.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "schedstat.h"
+
+struct schedstat prev[NPROC], cur[NPROC];
+int nprev;
+
+// s's counters at the start of the interval, or 0 if s is new.
+struct schedstat*
+lookup(struct schedstat *s)
+{
+  int i;
+
+  for(i = 0; i < nprev; i++)
+    if(prev[i].pid == s->pid)
+      return &prev[i];
+  return 0;
+}
+
+void
+report(int n)
+{
+  static struct schedstat zero;
+  struct schedstat *s, *o;
+  uint run, total, wtotal;
+  int i, b;
+
+  // Totals over the processes that ran in the interval.
+  total = wtotal = 0;
+  for(i = 0; i < n; i++){
+    s = &cur[i];
+    if((o = lookup(s)) == 0)
+      o = &zero;
+    if((run = ms(s->runtime - o->runtime)) > 0){
+      total += run;
+      wtotal += s->weight;
+    }
+  }
+
+  printf(1, "pid\tname\tstate\tnice\tcpu%%\twant%%\tvcsw\tivcsw\tmigr\tdelay\tmaxlat\n");
+  for(i = 0; i < n; i++){
+    s = &cur[i];
+    if((o = lookup(s)) == 0)
+      o = &zero;
+    run = ms(s->runtime - o->runtime);
+    printf(1, "%d\t%s\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
+           s->pid, s->name, states[s->state], s->nice,
+           total ? run*100/total : 0,
+           run && wtotal ? s->weight*100/wtotal : 0,
+           s->nvcsw - o->nvcsw, s->nivcsw - o->nivcsw,
+           s->nmigrations - o->nmigrations,
+           ms(s->run_delay - o->run_delay),
+           ms(s->max_wakeup_latency));
+    printf(1, "\tslices:");
+    for(b = 0; b < SCHED_NHIST; b++){
+      if(s->slice_hist[b] == 0)
+        continue;
+      if(b == 0)
+        printf(1, " <2ms:%d", s->slice_hist[b]);
+      else
+        printf(1, " %dms:%d", 1 << b, s->slice_hist[b]);
+    }
+    printf(1, "\n");
+  }
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int interval, count, i, n;
+
+  interval = 100;
+  count = 0;
+  if(argc > 1)
+    interval = atoi(argv[1]);
+  if(argc > 2)
+    count = atoi(argv[2]);
+  if(interval <= 0){
+    printf(2, "usage: schedtop [ticks [count]]\n");
+    exit();
+  }
+
+  if((nprev = schedstat(prev, NPROC)) < 0){
+    printf(2, "schedstat failed\n");
+    exit();
+  }
+  for(i = 0; count == 0 || i < count; i++){
+    sleep(interval);
+    if((n = schedstat(cur, NPROC)) < 0){
+      printf(2, "schedstat failed\n");
+      exit();
+    }
+    report(n);
+    memmove(prev, cur, n * sizeof(cur[0]));
+    nprev = n;
+  }
+  exit();
+}
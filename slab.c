@@ -0,0 +1,276 @@
+// Slab allocator.
+//
+// Hands out fixed-size kernel objects from typed caches, so
+// that small structures neither waste a whole page each nor
+// live in fixed-size static tables.  Each cache carves pages
+// from kalloc() into slabs of equal objects.  A slab's header
+// sits at the start of its page, so freeing an object finds
+// its slab by rounding the address down.  Slabs with free
+// objects are kept on a partial list, so allocation does not
+// search.  At most one completely free slab is kept per
+// cache; other empty slabs go back to kalloc().
+//
+// As in kalloc.c, each CPU has a magazine of free objects for
+// each cache, and objects move between a magazine and the
+// slabs SLAB_BATCH at a time, so the common path takes no
+// shared lock.  Lock order: magazine lock, then cache lock.
+//
+// Caches are created at boot, before other CPUs start, and
+// are never destroyed.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slabstat.h"
+
+#define NCACHE      16  // most caches
+#define SLAB_MAG    16  // most free objects a CPU caches per cache
+#define SLAB_BATCH  8   // objects moved to or from the slabs at once
+#define SLAB_ALIGN  8
+
+struct slab {
+  struct slab *next;
+  struct slab *prev;
+  struct kmem_cache *cache;
+  void *free;          // free objects, linked through their first word
+  uint inuse;          // objects handed out of this slab
+};
+
+struct slab_mag {
+  struct spinlock lock;
+  uint n;
+  void *obj[SLAB_MAG];
+};
+
+struct kmem_cache {
+  char name[16];
+  uint size;            // object size, rounded up to SLAB_ALIGN
+  uint perslab;         // objects in each slab
+  struct spinlock lock;
+  struct slab *partial; // slabs with some objects free
+  struct slab *full;
+  struct slab *empty;   // a spare slab with every object free, or 0
+  uint nslabs;
+  uint nalloc;          // objects out of the slabs, magazines included
+  struct slab_mag mag[NCPU];
+};
+
+#define SLAB_HDR  ((sizeof(struct slab) + SLAB_ALIGN-1) & ~(SLAB_ALIGN-1))
+
+struct {
+  struct kmem_cache cache[NCACHE];
+  int n;
+} slabtab;
+
+// Create a cache of objects of the given size.
+struct kmem_cache*
+kmem_cache_create(char *name, uint size)
+{
+  struct kmem_cache *c;
+  int i;
+
+  if(slabtab.n == NCACHE)
+    panic("kmem_cache_create: too many caches");
+  if(size < sizeof(void*))
+    size = sizeof(void*);
+  size = (size + SLAB_ALIGN-1) & ~(SLAB_ALIGN-1);
+  if(size > (PGSIZE - SLAB_HDR) / 2)
+    panic("kmem_cache_create: object too large");
+
+  c = &slabtab.cache[slabtab.n];
+  safestrcpy(c->name, name, sizeof(c->name));
+  c->size = size;
+  c->perslab = (PGSIZE - SLAB_HDR) / size;
+  initlock(&c->lock, "slab");
+  for(i = 0; i < NCPU; i++)
+    initlock(&c->mag[i].lock, "slabmag");
+  slabtab.n++;
+  return c;
+}
+
+//PAGEBREAK: 20
+// Slab lists.  Caller must hold c->lock.
+
+static void
+slab_push(struct slab **list, struct slab *s)
+{
+  s->prev = 0;
+  s->next = *list;
+  if(s->next)
+    s->next->prev = s;
+  *list = s;
+}
+
+static void
+slab_unlink(struct slab **list, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// A new slab for c, with all its objects on its free list.
+static struct slab*
+slab_grow(struct kmem_cache *c)
+{
+  struct slab *s;
+  char *obj;
+  uint i;
+
+  if((s = (struct slab*)kalloc()) == 0)
+    return 0;
+  s->cache = c;
+  s->inuse = 0;
+  s->free = 0;
+  obj = (char*)s + SLAB_HDR + (c->perslab - 1) * c->size;
+  for(i = 0; i < c->perslab; i++, obj -= c->size){
+    *(void**)obj = s->free;
+    s->free = obj;
+  }
+  c->nslabs++;
+  return s;
+}
+
+// Take one object out of c's slabs.
+static void*
+slab_get(struct kmem_cache *c)
+{
+  struct slab *s;
+  void *obj;
+
+  if((s = c->partial) == 0){
+    if((s = c->empty) != 0)
+      c->empty = 0;
+    else if((s = slab_grow(c)) == 0)
+      return 0;
+    slab_push(&c->partial, s);
+  }
+  obj = s->free;
+  s->free = *(void**)obj;
+  s->inuse++;
+  c->nalloc++;
+  if(s->free == 0){
+    slab_unlink(&c->partial, s);
+    slab_push(&c->full, s);
+  }
+  return obj;
+}
+
+// Put obj back in its slab.
+static void
+slab_put(struct kmem_cache *c, void *obj)
+{
+  struct slab *s;
+
+  s = (struct slab*)PGROUNDDOWN((uint)obj);
+  if(s->free == 0){
+    slab_unlink(&c->full, s);
+    slab_push(&c->partial, s);
+  }
+  *(void**)obj = s->free;
+  s->free = obj;
+  s->inuse--;
+  c->nalloc--;
+  if(s->inuse == 0){
+    slab_unlink(&c->partial, s);
+    if(c->empty == 0)
+      c->empty = s;
+    else {
+      c->nslabs--;
+      kfree((char*)s);
+    }
+  }
+}
+
+//PAGEBREAK: 30
+// Lock and return this CPU's magazine for c.
+static struct slab_mag*
+mag_lock(struct kmem_cache *c)
+{
+  struct slab_mag *m;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  acquire(&m->lock);
+  popcli();
+  return m;
+}
+
+// Allocate an object from c.  Returns 0 if out of memory.
+// The object's contents are undefined.
+void*
+kmem_cache_alloc(struct kmem_cache *c)
+{
+  struct slab_mag *m;
+  void *obj;
+
+  m = mag_lock(c);
+  if(m->n == 0){
+    acquire(&c->lock);
+    while(m->n < SLAB_BATCH && (obj = slab_get(c)) != 0)
+      m->obj[m->n++] = obj;
+    release(&c->lock);
+  }
+  obj = 0;
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  release(&m->lock);
+  return obj;
+}
+
+// Return obj, which must have come from c.
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+  struct slab_mag *m;
+  int i;
+
+  if(((struct slab*)PGROUNDDOWN((uint)obj))->cache != c)
+    panic("kmem_cache_free");
+
+  m = mag_lock(c);
+  if(m->n == SLAB_MAG){
+    acquire(&c->lock);
+    for(i = 0; i < SLAB_BATCH; i++)
+      slab_put(c, m->obj[--m->n]);
+    release(&c->lock);
+  }
+  m->obj[m->n++] = obj;
+  release(&m->lock);
+}
+
+// Statistics for cache i, for the slabinfo system call.
+// Returns -1 if there is no cache i.
+int
+slabstat(int i, struct slabstat *st)
+{
+  struct kmem_cache *c;
+  uint cached;
+  int cpu;
+
+  if(i < 0 || i >= slabtab.n)
+    return -1;
+  c = &slabtab.cache[i];
+
+  // Magazine counts are read without their locks: the
+  // numbers are a snapshot for monitoring, not exact.
+  cached = 0;
+  for(cpu = 0; cpu < NCPU; cpu++)
+    cached += c->mag[cpu].n;
+
+  acquire(&c->lock);
+  safestrcpy(st->name, c->name, sizeof(st->name));
+  st->objsize = c->size;
+  st->perslab = c->perslab;
+  st->nslabs = c->nslabs;
+  st->ntotal = c->nslabs * c->perslab;
+  st->ncached = cached;
+  st->nactive = c->nalloc > cached ? c->nalloc - cached : 0;
+  release(&c->lock);
+  return 0;
+}
@@ -0,0 +1,27 @@
+// Print kernel slab cache statistics.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "slabstat.h"
+
+#define NSTAT 16
+
+struct slabstat st[NSTAT];
+
+int
+main(void)
+{
+  int i, n;
+
+  if((n = slabinfo(st, NSTAT)) < 0){
+    printf(2, "slabinfo failed\n");
+    exit();
+  }
+  printf(1, "name\tsize\tperslab\tslabs\tobjs\tactive\tcached\n");
+  for(i = 0; i < n; i++)
+    printf(1, "%s\t%d\t%d\t%d\t%d\t%d\t%d\n", st[i].name, st[i].objsize,
+           st[i].perslab, st[i].nslabs, st[i].ntotal, st[i].nactive,
+           st[i].ncached);
+  exit();
+}
@@ -0,0 +1,12 @@
+// Slab cache statistics, as returned by the slabinfo
+// system call.
+
+struct slabstat {
+  char name[16];
+  uint objsize;   // bytes per object
+  uint perslab;   // objects per slab page
+  uint nslabs;    // slab pages held
+  uint ntotal;    // objects the slabs hold
+  uint nactive;   // objects in use
+  uint ncached;   // free objects in per-CPU magazines
+};
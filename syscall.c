@@ -21,6 +21,8 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
+  if(uvmprefault(addr, 4, 0) < 0)
+    return -1;
   *ip = *(int*)(addr);
   return 0;
 }
@@ -39,6 +41,8 @@ fetchstr(uint addr, char **pp)
   *pp = (char*)addr;
   ep = (char*)curproc->sz;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && uvmprefault((uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -52,11 +56,8 @@ argint(int n, int *ip)
   return fetchint((myproc()->tf->esp) + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+fetchptr(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
@@ -65,10 +66,30 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  if(uvmprefault(i, size, write) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space, and map its heap
+// pages in so the kernel can read it without faulting.
+int
+argptr(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 0);
+}
+
+// Like argptr, for a block the kernel writes: copy-on-write
+// pages in it are copied too.
+int
+argoutptr(int n, char **pp, int size)
+{
+  return fetchptr(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -107,10 +128,15 @@ extern int sys_getpname(void);
 extern int sys_getnice(void);
 extern int sys_setnice(void);
 extern int sys_ps(void);
+extern int sys_schedstat(void);
+extern int sys_procinfo(void);
 //project 4
 extern int sys_mmap(void);
 extern int sys_munmap(void);
 extern int sys_freemem(void);
+extern int sys_freeblocks(void);
+extern int sys_slabinfo(void);
+extern int sys_msync(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -138,11 +164,16 @@ static int (*syscalls[])(void) = {
 [SYS_getnice] sys_getnice,
 [SYS_setnice] sys_setnice,
 [SYS_ps] sys_ps,
+[SYS_schedstat] sys_schedstat,
+[SYS_procinfo] sys_procinfo,
 
 //project 4
 [SYS_mmap] sys_mmap,
 [SYS_munmap] sys_munmap,
 [SYS_freemem] sys_freemem,
+[SYS_freeblocks] sys_freeblocks,
+[SYS_slabinfo] sys_slabinfo,
+[SYS_msync] sys_msync,
 };
 
 void
@@ -6,6 +6,11 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "schedstat.h"
+#include "procstat.h"
+#include "slabstat.h"
 
 int
 sys_fork(void)
@@ -56,22 +61,30 @@ sys_sbrk(void)
   return addr;
 }
 
+// Sleep for n ticks, on a timer that wakes only this process
+// when it expires.
 int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
+  struct timer t;
 
   if(argint(0, &n) < 0)
     return -1;
+  if(n <= 0)
+    return 0;
   acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
+  t.expires = ticks + n;
+  t.func = timer_wakeup;
+  t.pending = 0;
+  timer_add(&t);
+  while(t.pending){
     if(myproc()->killed){
+      timer_del(&t);
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&t, &tickslock);
   }
   release(&tickslock);
   return 0;
@@ -130,6 +143,35 @@ sys_ps(void){
 	return 0;
 }
 
+int
+sys_schedstat(void)
+{
+  struct schedstat *buf;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NPROC)
+    n = NPROC;
+  if(argoutptr(0, (char**)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  return schedstat(buf, n);
+}
+
+int
+sys_procinfo(void)
+{
+  struct procstat *buf;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NPROC)
+    n = NPROC;
+  if(argoutptr(0, (char**)&buf, n*sizeof(*buf)) < 0)
+    return -1;
+  return procinfo(buf, n);
+}
 
 //project 4
 int
@@ -154,7 +196,47 @@ sys_munmap(void){
   return munmap(addr);
 }
 
+int
+sys_msync(void){
+  uint addr;
+  if (argint(0, (int*)&addr) < 0)
+    return -1;
+  return msync(addr);
+}
+
 int 
 sys_freemem(void){
   return freemem();
+}
+
+// Copy statistics for up to n slab caches into the user
+// array.  Returns the number of caches copied.
+int
+sys_slabinfo(void){
+  struct slabstat st;
+  uint addr;
+  int n, i;
+
+  if(argint(0, (int*)&addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  for(i = 0; i < n && slabstat(i, &st) == 0; i++)
+    if(copyout(myproc()->pgdir, addr + i*sizeof(st), &st, sizeof(st)) < 0)
+      return -1;
+  return i;
+}
+
+// Fill the user array with the number of free blocks of each
+// order, 0..MAXORDER.  Returns the free page total.
+int
+sys_freeblocks(void){
+  int nfree[MAXORDER+1];
+  uint addr;
+  int total;
+
+  if(argint(0, (int*)&addr) < 0)
+    return -1;
+  total = freeblocks(nfree);
+  if(copyout(myproc()->pgdir, addr, nfree, sizeof(nfree)) < 0)
+    return -1;
+  return total;
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+//TEST COPY-ON-WRITE FORK
+#include "types.h"
+#include "user.h"
+
+#define NPAGES 256  // 새 page table보다 훨씬 많게
+
+int main() {
+    char stack[64];
+    char *heap = sbrk(NPAGES * 4096);
+    int i, f0, f1, f2, ok;
+
+    for (i = 0; i < NPAGES; i++)
+        heap[i * 4096] = 'a';
+    stack[0] = 'a';
+    f0 = freemem();
+
+    if (fork() == 0) {
+        // fork 직후에는 page를 복사하지 않고 공유한다
+        f1 = freemem();
+        printf(1, "child: pages shared: %s (%d used)\n",
+               f0 - f1 < NPAGES ? "ok" : "FAILED", f0 - f1);
+
+        // 쓰면 그때 복사한다
+        for (i = 0; i < NPAGES; i++)
+            heap[i * 4096] = 'c';
+        stack[0] = 'c';
+        f2 = freemem();
+        printf(1, "child: pages copied on write: %s (%d copied)\n",
+               f1 - f2 >= NPAGES ? "ok" : "FAILED", f1 - f2);
+
+        ok = stack[0] == 'c';
+        for (i = 0; i < NPAGES; i++)
+            ok = ok && heap[i * 4096] == 'c';
+        printf(1, "child sees its own writes: %s\n", ok ? "ok" : "FAILED");
+        exit();
+    }
+    wait();
+
+    // 자식이 쓴 내용은 부모에게 보이지 않는다
+    ok = stack[0] == 'a';
+    for (i = 0; i < NPAGES; i++)
+        ok = ok && heap[i * 4096] == 'a';
+    printf(1, "parent unaffected by child: %s\n", ok ? "ok" : "FAILED");
+
+    for (i = 0; i < NPAGES; i++)
+        heap[i * 4096] = 'p';
+    stack[0] = 'p';
+    ok = stack[0] == 'p';
+    for (i = 0; i < NPAGES; i++)
+        ok = ok && heap[i * 4096] == 'p';
+    printf(1, "parent sees its own writes: %s\n", ok ? "ok" : "FAILED");
+    exit();
+}
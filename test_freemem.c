@@ -1,7 +1,19 @@
 #include "types.h"
 #include "user.h"
+#include "param.h"
 
 int main(int argc, char *argv[]) {
+    int nfree[MAXORDER+1];
+    int k;
+
     printf(1, "Free memory pages: %d\n", freemem());
+    if (freeblocks(nfree) < 0) {
+        printf(2, "freeblocks failed\n");
+        exit();
+    }
+    printf(1, "Free blocks by order:");
+    for (k = 0; k <= MAXORDER; k++)
+        printf(1, " %d", nfree[k]);
+    printf(1, "\n");
     exit();
-}
\ No newline at end of file
+}
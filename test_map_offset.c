@@ -0,0 +1,39 @@
+//TEST PRIVATE FILE MAPPING KEEPS THE FILE OFFSET
+#include "types.h"
+#include "user.h"
+#include "fcntl.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "proc.h"
+
+char buf[16];
+
+int main() {
+    int fd = open("README", O_RDONLY);
+    if (fd < 0) {
+        printf(1, "Failed to open file\n");
+        exit();
+    }
+    read(fd, buf, sizeof(buf));
+
+    // MAP_POPULATE로 file을 읽어도 fd의 offset은 그대로여야 한다
+    char *p = (char*)mmap(0, PGSIZE, PROT_READ, MAP_POPULATE, fd, 0);
+    if (p == 0) {
+        printf(1, "mmap failed\n");
+        exit();
+    }
+    read(fd, buf, sizeof(buf));
+
+    int ok = 1;
+    for (int i = 0; i < sizeof(buf); i++)
+        ok = ok && buf[i] == p[sizeof(buf) + i];
+    printf(1, "read continues from old offset: %s\n", ok ? "ok" : "FAILED");
+
+    munmap((uint)p);
+    close(fd);
+    exit();
+}
@@ -0,0 +1,37 @@
+//TEST MMAP PLACEMENT
+#include "types.h"
+#include "user.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "proc.h"
+
+int main() {
+    int prot = PROT_READ | PROT_WRITE;
+
+    // 주소를 주지 않으면 kernel이 겹치지 않는 곳을 고른다
+    uint a = mmap(0, 2 * PGSIZE, prot, MAP_ANONYMOUS, -1, 0);
+    uint b = mmap(0, PGSIZE, prot, MAP_ANONYMOUS, -1, 0);
+    if (a == 0 || b == 0) {
+        printf(1, "mmap failed\n");
+        exit();
+    }
+    printf(1, "no overlap: %s\n",
+           b >= a + 2 * PGSIZE || b + PGSIZE <= a ? "ok" : "FAILED");
+
+    // MAP_FIXED는 기존 mapping을 덮어쓰지 않는다
+    uint c = mmap(a + PGSIZE - MMAPBASE, PGSIZE, prot, MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    printf(1, "MAP_FIXED over a mapping fails: %s\n", c == 0 ? "ok" : "FAILED");
+
+    // munmap으로 생긴 빈 곳은 다시 쓰인다
+    munmap(a);
+    c = mmap(0, 2 * PGSIZE, prot, MAP_ANONYMOUS, -1, 0);
+    printf(1, "hole reused: %s\n", c == a ? "ok" : "FAILED");
+
+    munmap(b);
+    munmap(c);
+    exit();
+}
@@ -0,0 +1,77 @@
+//TEST SHARED FILE MAPPING
+#include "types.h"
+#include "user.h"
+#include "stat.h"
+#include "fcntl.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "proc.h"
+#include "syscall.h"
+
+char buf[64];
+
+int main() {
+    int fd = open("sharedfile", O_CREATE | O_RDWR);
+    if (fd < 0) {
+        printf(1, "Failed to open file\n");
+        exit();
+    }
+    memset(buf, 'a', sizeof(buf));
+    write(fd, buf, sizeof(buf));
+
+    char *p = (char*)mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == 0) {
+        printf(1, "mmap failed\n");
+        exit();
+    }
+    printf(1, "freemem0: %d\n", freemem());
+
+    // 자식이 쓴 내용이 부모에게도 보여야 한다
+    if (fork() == 0) {
+        char *q = (char*)mmap(0, 4096, PROT_READ, MAP_SHARED, fd, 0);
+        printf(1, "child: same page %s\n", q[0] == 'a' ? "ok" : "FAILED");
+        p[0] = 'b';
+        exit();
+    }
+    wait();
+    printf(1, "parent sees child's write: %s\n", p[0] == 'b' ? "ok" : "FAILED");
+    printf(1, "freemem1: %d\n", freemem());
+
+    // write()와 read()도 mapping과 같은 내용을 봐야 한다
+    int rfd = open("sharedfile", O_RDWR);
+    write(rfd, "e", 1);
+    printf(1, "mapping sees write(): %s\n", p[0] == 'e' ? "ok" : "FAILED");
+    p[0] = 'b';
+    p[1] = 'f';
+    read(rfd, buf, 1);
+    printf(1, "read() sees mapping: %s\n", buf[0] == 'f' ? "ok" : "FAILED");
+    close(rfd);
+
+    // msync 후에는 read()로도 보여야 한다
+    p[1] = 'c';
+    if (msync((uint)p) < 0) {
+        printf(1, "msync failed\n");
+        exit();
+    }
+    rfd = open("sharedfile", O_RDONLY);
+    read(rfd, buf, 2);
+    close(rfd);
+    printf(1, "file after msync: %s\n", buf[0] == 'b' && buf[1] == 'c' ? "ok" : "FAILED");
+
+    // munmap도 write back 한다
+    p[2] = 'd';
+    munmap((uint)p);
+    rfd = open("sharedfile", O_RDONLY);
+    read(rfd, buf, 3);
+    close(rfd);
+    printf(1, "file after munmap: %s\n", buf[2] == 'd' ? "ok" : "FAILED");
+    printf(1, "freemem2: %d\n", freemem());
+
+    close(fd);
+    unlink("sharedfile");
+    exit();
+}
@@ -0,0 +1,159 @@
+// Timer wheel.
+//
+// Kernel timers are kept in a hierarchical timing wheel, so
+// that the timer interrupt only touches timers that are due
+// instead of waking every process waiting for time to pass.
+//
+// Level 0 has one slot for each of the next 256 ticks.  Each
+// of the four levels above it has 64 slots, each covering 64
+// times the span of a slot one level down.  A timer is filed
+// at the lowest level whose range covers its expiry.  Each
+// time level 0 wraps around, the next slot of level 1 is
+// cascaded: its timers are refiled, now into level 0, and so
+// on up.  Adding and removing a timer is O(1); each timer is
+// moved at most once per level.
+//
+// All timer state is protected by tickslock, which callers
+// of timer_add() and timer_del() must hold.  Timer functions
+// run from the timer interrupt on CPU 0, with tickslock held.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "timer.h"
+
+#define TVR_BITS  8
+#define TVN_BITS  6
+#define TVR_SIZE  (1 << TVR_BITS)
+#define TVN_SIZE  (1 << TVN_BITS)
+#define TVR_MASK  (TVR_SIZE - 1)
+#define TVN_MASK  (TVN_SIZE - 1)
+
+struct {
+  uint clk;                    // next tick to be processed
+  struct timer *tv1[TVR_SIZE];
+  struct timer *tvn[4][TVN_SIZE];
+} wheel;
+
+// Level-n slot index (n >= 1) of tick value t.
+#define TVN_INDEX(t, n)  (((t) >> (TVR_BITS + ((n)-1)*TVN_BITS)) & TVN_MASK)
+
+static void
+slot_insert(struct timer **slot, struct timer *t)
+{
+  t->next = *slot;
+  if(t->next)
+    t->next->pprev = &t->next;
+  t->pprev = slot;
+  *slot = t;
+}
+
+static void
+slot_remove(struct timer *t)
+{
+  *t->pprev = t->next;
+  if(t->next)
+    t->next->pprev = t->pprev;
+  t->next = 0;
+  t->pprev = 0;
+}
+
+// File t in the slot for its expiry relative to wheel.clk.
+static void
+internal_add(struct timer *t)
+{
+  uint expires, idx;
+  struct timer **slot;
+
+  expires = t->expires;
+  idx = expires - wheel.clk;
+  if((int)idx < 0){
+    // Already due: run at the next tick.
+    slot = &wheel.tv1[wheel.clk & TVR_MASK];
+  } else if(idx < TVR_SIZE){
+    slot = &wheel.tv1[expires & TVR_MASK];
+  } else if(idx < 1 << (TVR_BITS + TVN_BITS)){
+    slot = &wheel.tvn[0][TVN_INDEX(expires, 1)];
+  } else if(idx < 1 << (TVR_BITS + 2*TVN_BITS)){
+    slot = &wheel.tvn[1][TVN_INDEX(expires, 2)];
+  } else if(idx < 1 << (TVR_BITS + 3*TVN_BITS)){
+    slot = &wheel.tvn[2][TVN_INDEX(expires, 3)];
+  } else {
+    slot = &wheel.tvn[3][TVN_INDEX(expires, 4)];
+  }
+  slot_insert(slot, t);
+}
+
+// Add t to the wheel to fire at t->expires.
+// Caller must hold tickslock.
+void
+timer_add(struct timer *t)
+{
+  if(!holding(&tickslock))
+    panic("timer_add");
+  if(t->pending)
+    panic("timer_add pending");
+  t->pending = 1;
+  internal_add(t);
+}
+
+// Remove t from the wheel if it has not fired yet.
+// Caller must hold tickslock.
+void
+timer_del(struct timer *t)
+{
+  if(!holding(&tickslock))
+    panic("timer_del");
+  if(!t->pending)
+    return;
+  slot_remove(t);
+  t->pending = 0;
+}
+
+// Refile the timers of the level-n slot index.  Returns index,
+// so the caller knows whether to cascade the next level too.
+static int
+cascade(int n, int index)
+{
+  struct timer *t, *next;
+
+  t = wheel.tvn[n-1][index];
+  wheel.tvn[n-1][index] = 0;
+  for(; t; t = next){
+    next = t->next;
+    internal_add(t);
+  }
+  return index;
+}
+
+// Run the timers that are due as of ticks.  Called from the
+// timer interrupt, with tickslock held, after advancing ticks.
+void
+timer_tick(void)
+{
+  struct timer *t;
+  int index;
+
+  while((int)(ticks - wheel.clk) >= 0){
+    index = wheel.clk & TVR_MASK;
+    if(index == 0 &&
+       cascade(1, TVN_INDEX(wheel.clk, 1)) == 0 &&
+       cascade(2, TVN_INDEX(wheel.clk, 2)) == 0 &&
+       cascade(3, TVN_INDEX(wheel.clk, 3)) == 0)
+      cascade(4, TVN_INDEX(wheel.clk, 4));
+    wheel.clk++;
+    while((t = wheel.tv1[index]) != 0){
+      slot_remove(t);
+      t->pending = 0;
+      t->func(t);
+    }
+  }
+}
+
+// Timer function that wakes the processes sleeping on the timer.
+void
+timer_wakeup(struct timer *t)
+{
+  wakeup(t);
+}
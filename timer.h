@@ -0,0 +1,9 @@
+// Kernel timers, kept on the timer wheel in timer.c.
+
+struct timer {
+  uint expires;                  // value of ticks at which to fire
+  void (*func)(struct timer*);   // run at expiry, tickslock held
+  int pending;                   // on the wheel, not yet fired
+  struct timer *next;            // wheel slot list
+  struct timer **pprev;
+};
@@ -0,0 +1,98 @@
+// Show the busiest processes.
+//
+// usage: top [ticks [count]]
+//
+// Every ticks clock ticks (default 100), count times (default
+// forever), print the processes that ran in the last interval
+// ordered by the CPU time they used, with their share of it.
+// Times are in ms, rss is in KB.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "procstat.h"
+
+struct procstat prev[NPROC], cur[NPROC];
+int nprev;
+uint delta[NPROC];
+int order[NPROC];
+
+// CPU time p used since the last sample.
+uint
+used(struct procstat *p)
+{
+  int i;
+
+  for(i = 0; i < nprev; i++)
+    if(prev[i].pid == p->pid)
+      return ms(p->runtime - prev[i].runtime);
+  return ms(p->runtime);
+}
+
+void
+report(int n)
+{
+  struct procstat *p;
+  uint total;
+  int i, j, k;
+
+  total = 0;
+  for(i = 0; i < n; i++){
+    delta[i] = used(&cur[i]);
+    total += delta[i];
+  }
+
+  // Insertion sort by CPU time used, busiest first.
+  for(i = 0; i < n; i++){
+    k = i;
+    for(j = i; j > 0 && delta[order[j-1]] < delta[k]; j--)
+      order[j] = order[j-1];
+    order[j] = k;
+  }
+
+  printf(1, "pid\tname\tstate\tnice\tcpu%%\ttime\trss\tmmap\n");
+  for(i = 0; i < n; i++){
+    p = &cur[order[i]];
+    if(delta[order[i]] == 0)
+      break;
+    printf(1, "%d\t%s\t%s\t%d\t%d\t%d\t%d\t%d\n",
+           p->pid, p->name, states[p->state], p->nice,
+           delta[order[i]]*100/total, ms(p->runtime),
+           p->rss * 4, p->nmmap);
+  }
+  printf(1, "\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int interval, count, i, n;
+
+  interval = 100;
+  count = 0;
+  if(argc > 1)
+    interval = atoi(argv[1]);
+  if(argc > 2)
+    count = atoi(argv[2]);
+  if(interval <= 0){
+    printf(2, "usage: top [ticks [count]]\n");
+    exit();
+  }
+
+  if((nprev = procinfo(prev, NPROC)) < 0){
+    printf(2, "top: procinfo failed\n");
+    exit();
+  }
+  for(i = 0; count == 0 || i < count; i++){
+    sleep(interval);
+    if((n = procinfo(cur, NPROC)) < 0){
+      printf(2, "top: procinfo failed\n");
+      exit();
+    }
+    report(n);
+    memmove(prev, cur, n * sizeof(cur[0]));
+    nprev = n;
+  }
+  exit();
+}
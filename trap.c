@@ -43,6 +43,8 @@ trap(struct trapframe *tf)
     syscall();
     if(myproc()->killed)
       exit();
+    if(need_resched())
+      yield();
     return;
   }
 
@@ -50,33 +52,34 @@ trap(struct trapframe *tf)
   //project4
   case T_PGFLT:{
     //page fault logic 추가하기
+    //(copy-on-write, mmap area, ...)
     uint fault_addr = rcr2();
-    if(page_fault(tf, fault_addr)==-1){
-      myproc()->killed = 1;
+    if(myproc() && page_fault(tf, fault_addr) == 0)
       break;
+    if(myproc() == 0 || (tf->cs&3) == 0){
+      // The kernel touched a bad address.  User pages the kernel
+      // uses are mapped, and copied if it writes them, beforehand
+      // by argptr(), argoutptr() and copyout(), which fail the
+      // system call if out of memory, so this is a kernel bug.
+      cprintf("page fault from cpu %d eip %x (cr2=0x%x)\n",
+              cpuid(), tf->eip, fault_addr);
+      panic("trap");
     }
+    myproc()->killed = 1;
     break;}
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
-      wakeup(&ticks);
+      timer_tick();
       release(&tickslock);
     }
-    
-    if((tf->cs & 3)== DPL_USER){
-      if(myproc()){
-        (myproc()->runtick)++;
-        
-        uint curr_tick = ticks;
-        myproc()-> runtime +=(curr_tick - myproc()-> startTime)*1000;
-        uint temp = myproc()->vruntime;
-        myproc()->vruntime +=((curr_tick - myproc()->startTime) * ((float)1024/(float)myproc()->weight)*1000);
-        if(myproc()->vruntime < temp)
-          (myproc()->carry)++;
-      }
-    }
-    
+    scheduler_tick();
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Another CPU woke a process that should preempt ours;
+    // need_resched() is already set, see below.
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -123,16 +126,11 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
-  // Force process to give up CPU on clock tick.
+  // Force process to give up CPU when the scheduler asks: its time
+  // slice ran out, or a process that should preempt it woke up.
   // If interrupts were on while locks held, would need to check nlock.
-  if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER){
-      (myproc()->runtick)++;
-
-      if( (myproc()->runtick * 1000) >= myproc()->timeSlice)
-        yield();
-      
-  }
+  if(myproc() && myproc()->state == RUNNING && need_resched())
+    yield();
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
@@ -104,3 +104,32 @@ memmove(void *vdst, const void *vsrc, int n)
     *dst++ = *src++;
   return vdst;
 }
+
+// n / d for d < 2^16.  User programs are not linked with
+// libgcc, so divide 64 bits one 16-bit digit at a time.
+uint64
+div64(uint64 n, uint d)
+{
+  uint64 q;
+  uint r;
+  int i;
+
+  q = 0;
+  r = 0;
+  for(i = 48; i >= 0; i -= 16){
+    r = (r << 16) | ((n >> i) & 0xffff);
+    q = (q << 16) | (r / d);
+    r %= d;
+  }
+  return q;
+}
+
+// Nanoseconds to milliseconds, for ps, top and schedtop.
+uint
+ms(uint64 ns)
+{
+  return div64(div64(ns, 1000), 1000);
+}
+
+// Names of the process states, indexed by enum procstate.
+char *states[] = { "unused", "embryo", "sleep", "runble", "run", "zombie" };
@@ -6,13 +6,24 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "spinlock.h"
 #include "traps.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
 
 
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// A PTE bit the hardware leaves to software: the page was
+// writable, but is shared copy-on-write and mapped read-only.
+#define PTE_COW  0x800
+
+// Set by the hardware when a page is written.
+#define PTE_D    0x040
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -45,10 +56,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
+    // kzalloc() makes sure all those PTE_P bits are zero.
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
       return 0;
-    // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -234,13 +244,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kzalloc();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -281,6 +290,26 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Number of pages mapped in pgdir from user address start
+// up to end.
+int
+residentuvm(pde_t *pgdir, uint start, uint end)
+{
+  pte_t *pte;
+  uint a;
+  int n;
+
+  n = 0;
+  for(a = PGROUNDUP(start); a < end; a += PGSIZE){
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if(!pte)
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+    else if(*pte & PTE_P)
+      n++;
+  }
+  return n;
+}
+
 // Free a page table and all the physical memory pages
 // in the user part.
 void
@@ -313,32 +342,137 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Map the page that pte maps in the parent at va into d as
+// well, sharing it.  A writable page becomes read-only and
+// copy-on-write in both.  The caller must flush the parent's
+// TLB.
+static int
+share_page(pde_t *d, pte_t *pte, uint va)
+{
+  uint pa;
+
+  if(*pte & PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+  pa = PTE_ADDR(*pte);
+  if(mappages(d, (void*)va, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
+    return -1;
+  kpage_get(P2V(pa));
+  return 0;
+}
+
+// Give the process its own writable copy of the copy-on-write
+// page that pte maps, or, if no one else shares the page any
+// more, just make it writable again.  Returns -1 if out of
+// memory.
+static int
+cow_copy(pte_t *pte)
+{
+  uint pa, flags;
+  char *mem;
+
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+  if(kpage_refs(P2V(pa)) == 1){
+    *pte = pa | flags;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)P2V(pa), PGSIZE);
+  *pte = V2P(mem) | flags;
+  kfree(P2V(pa));
+  return 0;
+}
+
+// If the page at va in pgdir is copy-on-write, copy it so that
+// it can be written.  Returns 1 if it was copied, 0 if it was
+// not copy-on-write, -1 if out of memory.
+int
+cow_resolve(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  pte = walkpgdir(pgdir, (void*)va, 0);
+  if(pte == 0 || (*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return 0;
+  if(cow_copy(pte) < 0)
+    return -1;
+  if(myproc() && myproc()->pgdir == pgdir)
+    lcr3(V2P(pgdir));  // drop the stale read-only mapping
+  return 1;
+}
+
+// sbrk() only grows p->sz; heap pages are mapped, zeroed, on
+// first touch.  If the page at va, which must be below p->sz,
+// is not mapped yet, map a zero page there.  Returns -1 if
+// out of memory.
+int
+lazy_alloc(struct proc *p, uint va)
+{
+  pte_t *pte;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  if((pte = walkpgdir(p->pgdir, (void*)va, 1)) == 0)
+    return -1;
+  if(*pte & PTE_P)
+    return 0;
+  if((mem = kzalloc()) == 0)
+    return -1;
+  *pte = V2P(mem) | PTE_W | PTE_U | PTE_P;
+  p->rss++;
+  return 0;
+}
+
+// Map the heap pages of [va, va+len) in the current process
+// that have not been touched yet, and if the kernel is going
+// to write the range, copy its copy-on-write pages, as
+// copyout() does, so that the kernel does not fault on a
+// system call argument it is about to use.  Returns -1 if out
+// of memory.
+int
+uvmprefault(uint va, uint len, int write)
+{
+  struct proc *p = myproc();
+  uint a, last;
+
+  if(len == 0)
+    return 0;
+  last = PGROUNDDOWN(va + len - 1);
+  for(a = PGROUNDDOWN(va); ; a += PGSIZE){
+    if(a < p->sz && lazy_alloc(p, a) < 0)
+      return -1;
+    if(write && cow_resolve(p->pgdir, a) < 0)
+      return -1;
+    if(a == last)
+      break;
+  }
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  Pages are shared copy-on-write rather
+// than copied, so this costs page tables, not page contents.
+// Heap pages not touched yet are not mapped in either.
+// The caller must flush the parent's TLB.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
-  uint pa, i, flags;
-  char *mem;
+  uint i;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
-    pa = PTE_ADDR(*pte);
-    flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+      continue;
+    if(share_page(d, pte, i) < 0)
       goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
-      goto bad;
-    }
   }
   return d;
 
@@ -355,7 +489,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -365,6 +499,9 @@ uva2ka(pde_t *pgdir, char *uva)
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
+// Copy-on-write pages are copied first, since the kernel
+// writes them through their physical address, and heap pages
+// of the current process not touched yet are mapped.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
@@ -374,6 +511,11 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    if(myproc() && myproc()->pgdir == pgdir && va0 < myproc()->sz &&
+       lazy_alloc(myproc(), va0) < 0)
+      return -1;
+    if(cow_resolve(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
@@ -397,17 +539,189 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 
 //project 4
 
-struct mmap_area mmap_areas[MAX_MMAP_AREA];
-int mmap_area_count = 0;
+// Each process keeps its mmap areas in a red-black tree,
+// p->vmas, ordered by start address, so that a fault finds its
+// area in O(log n).  Records come from a slab cache, so there
+// is no limit on their number and freed ones are reused.
+// mmaps.lock protects every process's tree.
+struct {
+  struct spinlock lock;
+  struct kmem_cache *cache;
+} mmaps;
+
+static int
+vma_less(struct rb_node *a, struct rb_node *b)
+{
+  return rb_entry(a, struct mmap_area, rb)->addr <
+         rb_entry(b, struct mmap_area, rb)->addr;
+}
+
+// The area of p that contains addr, or 0.
+// Caller must hold mmaps.lock.
+static struct mmap_area*
+vma_lookup(struct proc *p, uint addr)
+{
+  struct rb_node *n;
+  struct mmap_area *a, *best;
+
+  // Find the last area starting at or below addr.
+  best = 0;
+  n = p->vmas.node;
+  while(n){
+    a = rb_entry(n, struct mmap_area, rb);
+    if(addr < a->addr)
+      n = n->left;
+    else {
+      best = a;
+      n = n->right;
+    }
+  }
+  if(best && addr < best->addr + best->length)
+    return best;
+  return 0;
+}
+
+// Does [start, end) overlap any of p's areas?
+// Caller must hold mmaps.lock.
+static int
+vma_overlaps(struct proc *p, uint start, uint end)
+{
+  struct rb_node *n;
+  struct mmap_area *a, *best;
+
+  // Areas do not overlap, so their ends are sorted too: find
+  // the first area ending above start and see where it begins.
+  best = 0;
+  n = p->vmas.node;
+  while(n){
+    a = rb_entry(n, struct mmap_area, rb);
+    if(a->addr + a->length > start){
+      best = a;
+      n = n->left;
+    } else
+      n = n->right;
+  }
+  return best && best->addr < end;
+}
+
+// Lowest free range of length bytes in p's mmap region,
+// or 0 if there is none.  Caller must hold mmaps.lock.
+static uint
+vma_gap(struct proc *p, uint length)
+{
+  struct rb_node *n;
+  struct mmap_area *a;
+  uint start;
+
+  start = MMAPBASE;
+  for(n = rb_first(&p->vmas); n; n = rb_next(n)){
+    a = rb_entry(n, struct mmap_area, rb);
+    if(a->addr - start >= length)
+      return start;
+    start = a->addr + a->length;
+  }
+  if(KERNBASE - start >= length)
+    return start;
+  return 0;
+}
+
+// Choose where a new mapping of length bytes goes and insert
+// area there.  addr is an offset into the mmap region.  With
+// MAP_FIXED the mapping must go exactly at addr; otherwise a
+// non-zero addr is a hint, and the lowest gap that fits is
+// used when the hint is taken or addr is 0.  Never replaces
+// an existing mapping.  Returns the address, or 0.
+static uint
+vma_place(struct proc *p, struct mmap_area *area, uint addr, uint length, int flags)
+{
+  uint start;
+
+  acquire(&mmaps.lock);
+  start = 0;
+  if(addr < KERNBASE - MMAPBASE && length <= KERNBASE - MMAPBASE - addr &&
+     (addr != 0 || (flags & MAP_FIXED))){
+    start = MMAPBASE + addr;
+    if(vma_overlaps(p, start, start + length))
+      start = 0;
+  }
+  if(start == 0 && !(flags & MAP_FIXED))
+    start = vma_gap(p, length);
+  if(start != 0){
+    area->addr = start;
+    rb_insert(&p->vmas, &area->rb, vma_less);
+  }
+  release(&mmaps.lock);
+  return start;
+}
+
+void
+mmapinit(void)
+{
+  initlock(&mmaps.lock, "mmaps");
+  mmaps.cache = kmem_cache_create("mmap_area", sizeof(struct mmap_area));
+}
+
+struct mmap_area* find_mmap_area(uint addr){
+  struct proc *p = myproc();
+  struct mmap_area *a;
+
+  acquire(&mmaps.lock);
+  if((a = vma_lookup(p, addr)) != 0 && a->addr != addr)
+    a = 0;
+  release(&mmaps.lock);
+  return a;
+}
+
+// Unmap the pages of area a that its process has mapped.
+// Dirty pages of a shared mapping are written back to the
+// file first, so this may sleep and must not be called inside
+// a transaction.
+static void
+vma_unmap(struct mmap_area *a)
+{
+  struct proc *p = a->p;
+  pte_t *pte;
+  char *page;
+  uint va;
+
+  for(va = a->addr; va < a->addr + a->length; va += PGSIZE){
+    if((pte = walkpgdir(p->pgdir, (void*)va, 0)) == 0){
+      va = PGADDR(PDX(va) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    page = P2V(PTE_ADDR(*pte));
+    if(a->flags & MAP_SHARED){
+      if(*pte & PTE_D)
+        pcache_writeback(a->f->ip, a->offset + (va - a->addr), page);
+      *pte = 0;
+      pcache_put(a->f->ip, a->offset + (va - a->addr), page);
+    } else {
+      *pte = 0;
+      kfree(page);
+    }
+    p->rss--;
+  }
+  if(p == myproc())
+    lcr3(V2P(p->pgdir));
+}
+
+// Unmap area a's pages and drop it.
+void remove_mmap_area(struct mmap_area *target){
+  acquire(&mmaps.lock);
+  rb_erase(&target->p->vmas, &target->rb);
+  release(&mmaps.lock);
+  vma_unmap(target);
+  if(target->f)
+    fileclose(target->f);
+  kmem_cache_free(mmaps.cache, target);
+}
 
 uint 
 mmap(uint addr, int length, int prot, int flags , int fd, int offset){
   
   //===========VALIDATE THE INPUTS===========
-  if (mmap_area_count >= MAX_MMAP_AREA) {
-    // Maximum number of mmap areas reached
-    return 0;
-  }
   if(addr % PGSIZE !=0){ //addr이 Page size 와 align되었는지 확인
     return 0;
   }
@@ -421,136 +735,207 @@ mmap(uint addr, int length, int prot, int flags , int fd, int offset){
     return 0;
   }
   struct proc *p = myproc();
+  struct file *file = 0;
 
-  //======initialize new area to add======
-  struct mmap_area new_area;
-  new_area.addr = addr + MMAPBASE;
-  new_area.length = length;
-  new_area.prot = prot;
-  new_area.flags = flags;
-  new_area.offset = offset;
-  new_area.p = p;
-
-  
-  /*FILE MAPPING*/
   if (fd != -1 && !(flags & MAP_ANONYMOUS)) { //fd가 -1이 아니다 && flags가 MAP_ANONYMOUS인 경우
-
-    struct file *file = p->ofile[fd];
-    if(file == 0){ //해당 파일 존재X
+    if(fd < 0 || fd >= NOFILE || (file = p->ofile[fd]) == 0){ //해당 파일 존재X
+      return 0;
+    }
+    if(file->type != FD_INODE){ //pipe는 매핑할 수 없음
       return 0;
     }
-    new_area.f = file;
     if(!file_is_readable(file) && (prot & PROT_READ)){
       return 0;
     }
     if(!file_is_writable(file) && (prot & PROT_WRITE)){ //file is not readable
       return 0;
     }
-    set_offset(file, offset);
+    //MAP_SHARED page는 page cache에서 page 단위로 공유
+    if((flags & MAP_SHARED) && offset % PGSIZE != 0){
+      return 0;
+    }
+  } else if (fd != -1 || offset != 0 || (flags & MAP_SHARED)){
+    return 0;
+  }
 
-    if(MAP_POPULATE & flags){ //file mapping with MAP_POPULATE
-      //physical 메모리에 할당하고 page table entry에 저장
-      int num_pages = length / PGSIZE;
+  struct mmap_area *area = kmem_cache_alloc(mmaps.cache); //slab에서 mmap_area 할당
+  if(area == 0){
+    return 0;
+  }
 
-      if(num_pages > freemem()){
-        //not enough free pages
-        return 0;
+  //======initialize new area to add======
+  area->f = file;
+  area->length = length;
+  area->prot = prot;
+  area->flags = flags;
+  area->offset = offset;
+  area->p = p;
+
+  //빈 공간을 골라서 tree에 넣는다 (다른 mapping과 겹치지 않음)
+  uint start = vma_place(p, area, addr, length, flags);
+  if(start == 0){
+    kmem_cache_free(mmaps.cache, area);
+    return 0;
+  }
+  p->nmmap++;
+  //mapping은 file을 따로 잡고 있는다 (fd를 닫아도, write back 때도 유효)
+  if(file)
+    filedup(file);
+
+  int cal_prot = 0;
+  if(PROT_WRITE & prot){
+    cal_prot = PTE_W|PTE_U;
+  }else{
+    cal_prot = PTE_U;
+  }
+
+  if(!(flags & MAP_POPULATE))
+    return start;
+
+  /*SHARED FILE MAPPING with map populate*/
+  if (flags & MAP_SHARED) {
+    for(uint va = start; va < start + length; va += PGSIZE){
+      char *page = pcache_get(file->ip, offset + (va - start));
+      if(!page){
+        goto bad;
+      }
+      if(mappages(p->pgdir, (void *)va, PGSIZE, V2P(page), cal_prot) < 0) {
+        pcache_put(file->ip, offset + (va - start), page);
+        goto bad;
       }
+      p->rss++;
+    }
+  }
+
+  /*FILE MAPPING with map populate*/
+  else if (file) {
+    //physical 메모리에 할당하고 page table entry에 저장
+    int num_pages = length / PGSIZE;
+
+    if(num_pages > freemem()){
+      //not enough free pages
+      goto bad;
+    }
 
-      for(int i=0; i<num_pages; i++){
-        char* buffer = kalloc();
-        
-        if (!buffer) {
-          return 0;
-        } 
-        
-        int r = fileread(file, buffer, PGSIZE);
-        
-        if(r <= 0){
-          return 0;
-        }
-        
-        uint va = (MMAPBASE+addr) + i * 4096;
-
-        int cal_prot = 0;
-        if(PROT_WRITE & prot){
-          cal_prot = PTE_W|PTE_U;
-        }else{
-          cal_prot = PTE_U;
-        }
-
-        if(mappages(p->pgdir, (void *)va, PGSIZE, V2P(buffer), cal_prot) < 0) {
-          return 0;
-        } 
-        //set_offset(file, offset+4096*(i+1));
+    for(int i=0; i<num_pages; i++){
+      char* buffer = kalloc();
+      
+      if (!buffer) {
+        goto bad;
+      } 
+      
+      if(readpage(file->ip, buffer, offset + i * PGSIZE) < 0){
+        kfree(buffer);
+        goto bad;
       }
       
-    }//file mapping with MAP_POPULATE
+      uint va = start + i * PGSIZE;
+      if(mappages(p->pgdir, (void *)va, PGSIZE, V2P(buffer), cal_prot) < 0) {
+        kfree(buffer);
+        goto bad;
+      } 
+      p->rss++;
+    }
   }/*FILE MAPPING*/
 
   /*ANNONYMOUS MAPPING with map populate*/
-  else if (fd ==-1 && offset == 0 && (flags & (MAP_POPULATE|MAP_ANONYMOUS))){   
-    new_area.f = 0;
+  else {
     int num_pages = length/PGSIZE;
     for(int i=0;i<num_pages;i++){
-      char* buffer = kalloc();
+      char* buffer = kzalloc(); //0으로 초기화된 페이지
 
-      if(!buffer){ //버퍼를 할당받지 못한경우, 이전것 모두 해제
-        for (int j = 0; j < i; j++) {
-          uint va = (MMAPBASE + addr) + j * PGSIZE;
-          kfree((char*)va);
-        }
-        return 0;
-      }
-
-      memset(buffer,0,PGSIZE); //메모리 0으로 initialize
-      uint va = (MMAPBASE + addr) + i * PGSIZE;
-      
-      int cal_prot = 0;
-      if(PROT_WRITE & prot){
-        cal_prot = PTE_W|PTE_U;
-      }else{
-        cal_prot = PTE_U;
+      if(!buffer){
+        goto bad;
       }
 
+      uint va = start + i * PGSIZE;
       if (mappages(p->pgdir, (void *)va, PGSIZE, V2P(buffer), cal_prot) < 0) {
-        for (int j = 0; j < i; j++) {
-          uint va = (MMAPBASE + addr) + j * PGSIZE;
-          kfree((char*)va);
-        }
-        return 0;
+        kfree(buffer);
+        goto bad;
       }
+      p->rss++;
     }
   }/*ANNONYMOUS MAPPING*/
 
-  /*ANNONYmOUSE MAPPING Without map populate*/
-  else if (fd ==-1 && offset == 0 && (flags & MAP_ANONYMOUS)){
-    new_area.f = 0;
-  }
-  
-  mmap_areas[mmap_area_count]= new_area;
-  mmap_area_count++;
-  
-  return new_area.addr;
+  return start;
+
+bad:
+  //지금까지 매핑한 page를 모두 해제하고 area를 제거
+  remove_mmap_area(area);
+  p->nmmap--;
+  return 0;
 }
 
-struct mmap_area* find_mmap_area(uint addr){
-  struct proc *p = myproc();
-  for(int i=0;i<MAX_MMAP_AREA;i++){
-    if(mmap_areas[i].addr == addr && mmap_areas[i].p == p){
-      return &mmap_areas[i];
+// Give child a copy of each of parent's mmap areas.  The pages
+// the parent has mapped in private areas are shared
+// copy-on-write; those in shared areas are simply shared.
+// Returns -1 if out of memory.  The caller must flush the
+// parent's TLB.
+int
+mmap_copy(struct proc *parent, struct proc *child)
+{
+  struct mmap_area *a, *na;
+  struct rb_node *n;
+  pte_t *pte;
+  uint start;
+
+  acquire(&mmaps.lock);
+  for(n = rb_first(&parent->vmas); n; n = rb_next(n)){
+    a = rb_entry(n, struct mmap_area, rb);
+    //부모 process의 mmap_area를 복사해서 p만 바꾸고 자식의 tree에 삽입
+    if((na = kmem_cache_alloc(mmaps.cache)) == 0)
+      goto bad;
+    *na = *a;
+    na->p = child;
+    rb_insert(&child->vmas, &na->rb, vma_less);
+    child->nmmap++;
+    if(na->f)
+      filedup(na->f);
+
+    for(start = a->addr; start < a->addr + a->length; start += PGSIZE){
+      if((pte = walkpgdir(parent->pgdir, (void*)start, 0)) == 0)
+        continue; //map populate가 아니였고, access한적이 없음
+      if(!(*pte & PTE_P)) //not present
+        continue;
+      if(a->flags & MAP_SHARED){
+        //page cache의 page를 그대로 공유
+        if(mappages(child->pgdir, (void*)start, PGSIZE, PTE_ADDR(*pte),
+                    PTE_FLAGS(*pte) & ~PTE_D) < 0)
+          goto bad;
+        kpage_get(P2V(PTE_ADDR(*pte)));
+        child->rss++;
+        continue;
+      }
+      //부모의 physical page를 copy-on-write로 공유
+      if(share_page(child->pgdir, pte, start) < 0)
+        goto bad;
     }
   }
+  release(&mmaps.lock);
   return 0;
+
+bad:
+  release(&mmaps.lock);
+  return -1;
 }
 
-void remove_mmap_area(struct mmap_area *target){
-  for(int i=0;i<MAX_MMAP_AREA;i++){
-    if(&mmap_areas[i] == target){
-      memset(&mmap_areas[i], 0, sizeof(struct mmap_area));
+// Unmap all of p's mmap areas, when it exits or execs,
+// writing back dirty shared pages.  Must not be called inside
+// a transaction.
+void
+mmap_release(struct proc *p)
+{
+  struct rb_node *n;
+
+  for(;;){
+    acquire(&mmaps.lock);
+    n = rb_first(&p->vmas);
+    release(&mmaps.lock);
+    if(n == 0)
       break;
-    }
+    remove_mmap_area(rb_entry(n, struct mmap_area, rb));
   }
+  p->nmmap = 0;
 }
 
 int 
@@ -570,32 +955,63 @@ munmap(uint addr){
     return -1;
   }
   
-  for(uint a = addr; a < addr + area->length; a+=PGSIZE){
-    pte_t *pte = walkpgdir(p->pgdir, (void*)a, 0);
-    if(!pte)
-      a = PGADDR(PDX(a)+1,0,0) - PGSIZE;
-    if(pte && (*pte & PTE_P)){ //해당 page가 page table에 있다
-      char* phyical_page = P2V(PTE_ADDR(*pte));
-      kfree(phyical_page);
-      *pte = 0;
-    }
-  }
-  
+  //page를 해제하고 (shared면 dirty page를 file에 쓰고) area 제거
   remove_mmap_area(area);
+  p->nmmap--;
   return 1;
 }
 
+// Write the dirty pages of the shared mapping at addr back to
+// its file.  Returns 0, or -1 if there is no mapping at addr.
+int
+msync(uint addr)
+{
+  struct proc *p = myproc();
+  struct mmap_area *area;
+  pte_t *pte;
+  uint va;
+
+  if((area = find_mmap_area(addr)) == 0)
+    return -1;
+  if(!(area->flags & MAP_SHARED))
+    return 0;
+
+  for(va = area->addr; va < area->addr + area->length; va += PGSIZE){
+    if((pte = walkpgdir(p->pgdir, (void*)va, 0)) == 0){
+      va = PGADDR(PDX(va) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    //dirty bit를 먼저 지워서 write back 중의 write도 다음에 반영
+    *pte &= ~PTE_D;
+    lcr3(V2P(p->pgdir));
+    pcache_writeback(area->f->ip, area->offset + (va - area->addr),
+                     P2V(PTE_ADDR(*pte)));
+  }
+  return 0;
+}
+
 int page_fault(struct trapframe *tf, uint fault_addr)
 {
   fault_addr = PGROUNDDOWN(fault_addr); //접근 주소에 알맞는 페이지를 찾는다
-  // mmap_area에 해당주소 매핑되어 있는지 확인
-  struct mmap_area *area = 0;
-  for(int i = 0; i<MAX_MMAP_AREA;i++){
-    if(mmap_areas[i].p == myproc() && mmap_areas[i].addr <= fault_addr && fault_addr <mmap_areas[i].addr+mmap_areas[i].length){
-      area = &mmap_areas[i];
-      break;
-    }
+
+  //copy-on-write page에 대한 write: 복사해서 쓸 수 있게 한다
+  if(tf->err & 2){
+    int r = cow_resolve(myproc()->pgdir, fault_addr);
+    if(r != 0)
+      return r > 0 ? 0 : -1;
   }
+
+  //sbrk로 늘어났지만 아직 접근하지 않은 heap page: 0으로 채운 page를 매핑
+  //(present한 page의 fault, 예를 들어 stack guard page는 여기서 처리하지 않음)
+  if(fault_addr < myproc()->sz && !(tf->err & 1))
+    return lazy_alloc(myproc(), fault_addr);
+  // mmap_area에 해당주소 매핑되어 있는지 확인
+  struct mmap_area *area;
+  acquire(&mmaps.lock);
+  area = vma_lookup(myproc(), fault_addr);
+  release(&mmaps.lock);
   if (area == 0) //없음
   {
     return -1;
@@ -616,28 +1032,29 @@ int page_fault(struct trapframe *tf, uint fault_addr)
     return -1;
   }
   
-  char *mem = kalloc();
+  char *mem;
+  uint diff = area->offset + fault_addr - area->addr;
+  if (area->flags & MAP_SHARED)
+    mem = pcache_get(area->f->ip, diff); //다른 process와 공유하는 page
+  else if (area->flags & MAP_ANONYMOUS)
+    mem = kzalloc(); //0으로 초기화된 페이지
+  else
+    mem = kalloc();
   if (mem == 0)
   {
     return -1;
   }
 
 
-  if(!(area->flags & MAP_ANONYMOUS)){//file mapping
+  if(!(area->flags & (MAP_ANONYMOUS|MAP_SHARED))){//private file mapping
     //파일에서 데이터 읽어와서 phyiscal page에 write
     //OFFSET 계산
     
-    uint diff = area->offset + fault_addr - area->addr;
-    set_offset(area->f,  diff); //현재 page fault가 발생한 파일의 오프셋 결정 
-    int r = fileread(area->f, mem, PGSIZE);
-
-    if(r <=0){
+    //file offset은 건드리지 않고 inode에서 직접 읽는다 (EOF 이후는 0)
+    if(readpage(area->f->ip, mem, diff) < 0){
+      kfree(mem);
       return -1;
     }
-
-
-  }else{//ANNONYMOUS MAPPING
-    memset(mem, 0, PGSIZE); //initialize with 0s
   }
 
   int cal_prot = 0;
@@ -648,7 +1065,12 @@ int page_fault(struct trapframe *tf, uint fault_addr)
   }
   if (mappages(myproc()->pgdir, (char *)fault_addr, PGSIZE, V2P(mem), cal_prot) < 0)  //mappages 실패
   {//page table에 mapping
+    if (area->flags & MAP_SHARED)
+      pcache_put(area->f->ip, diff, mem);
+    else
+      kfree(mem);
     return -1;
   }
+  myproc()->rss++;
   return 0;
 }